@@ -0,0 +1,347 @@
+#pragma once
+#include "concurrent_event_stream.h"
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <tuple>
+#include <optional>
+#include <stdexcept>
+
+/// what 'emit' does when a worker's queue is full
+enum class event_backpressure
+{
+    /// wait until the worker made room
+    block,
+
+    /// throw away the oldest queued event to make room
+    drop_oldest,
+
+    /// throw away the event being emitted
+    drop_newest,
+};
+
+namespace event_stream_internal {
+
+/// bounded lock-free multi-producer multi-consumer ring (dmitry vyukov's), every
+/// cell carries a sequence number telling whether it is free for the producer of
+/// that lap or filled for its consumer, so push and pop are a single cas each
+template<class T>
+class event_ring
+{
+    struct event_cell
+    {
+        std::atomic<size_t> _sequence;
+
+        std::optional<T> _value;
+    };
+public:
+    explicit event_ring(size_t capacity)
+    {
+        size_t size = 2;
+        while (size < capacity) size <<= 1;
+
+        _mask = size - 1;
+        _cells.reset(new event_cell[size]);
+        for (size_t i = 0; i < size; i++) {
+            _cells[i]._sequence.store(i, std::memory_order_relaxed);
+        }
+        _enqueue_pos.store(0, std::memory_order_relaxed);
+        _dequeue_pos.store(0, std::memory_order_relaxed);
+    }
+
+    /// false when full
+    template<class U>
+    bool try_push(U&& value)
+    {
+        size_t pos = _enqueue_pos.load(std::memory_order_relaxed);
+        for (;;) {
+            auto& cell = _cells[pos & _mask];
+            size_t sequence = cell._sequence.load(std::memory_order_acquire);
+            intptr_t diff = intptr_t(sequence) - intptr_t(pos);
+            if (diff == 0) {
+                if (_enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    cell._value.emplace(std::forward<U>(value));
+                    cell._sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = _enqueue_pos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    /// false when empty
+    bool try_pop(std::optional<T>& value)
+    {
+        size_t pos = _dequeue_pos.load(std::memory_order_relaxed);
+        for (;;) {
+            auto& cell = _cells[pos & _mask];
+            size_t sequence = cell._sequence.load(std::memory_order_acquire);
+            intptr_t diff = intptr_t(sequence) - intptr_t(pos + 1);
+            if (diff == 0) {
+                if (_dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    value.emplace(std::move(*cell._value));
+                    cell._value.reset();
+                    cell._sequence.store(pos + _mask + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = _dequeue_pos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    /// approximate while pushing or popping
+    size_t size() const
+    {
+        size_t enqueue_pos = _enqueue_pos.load(std::memory_order_relaxed);
+        size_t dequeue_pos = _dequeue_pos.load(std::memory_order_relaxed);
+        return enqueue_pos > dequeue_pos ? enqueue_pos - dequeue_pos : 0;
+    }
+private:
+    std::unique_ptr<event_cell[]> _cells;
+
+    size_t _mask;
+
+    alignas(64) std::atomic<size_t> _enqueue_pos;
+
+    alignas(64) std::atomic<size_t> _dequeue_pos;
+private:
+    event_ring(const event_ring&);
+    event_ring& operator=(const event_ring&);
+};
+
+}
+
+template<class T>
+class async_event_stream
+{
+};
+
+/// event_stream whose 'emit' only queues the event and returns, the handlers run
+/// on a pool of worker threads, so a slow subscriber never holds up the emitter.
+///
+/// every subscriber is pinned to one worker (round robin at subscribe), each worker
+/// has its own bounded lock-free ring and runs its events one by one, so a handler
+/// sees events in emit order (for emits from one thread, or emits ordered by the
+/// caller) and is never called concurrently with itself. 'emit' copies the event
+/// once into the ring of every worker having subscribers, nothing is allocated.
+///
+/// when a ring is full the backpressure policy decides, a drop only affects the
+/// subscribers of that worker. workers sleep on an atomic wait when idle.
+///
+/// the destructor lets workers run what is queued and joins them. handlers run
+/// on worker threads and must not throw. reference parameters can't be written
+/// back, parameters are stored by value in the queue.
+///
+/// a guid is the worker's guid in the low 26 bits and the worker index in the
+/// high 6 bits, so there are at most 64 workers and each worker hands out about
+/// 67M guids over the stream's life, 'subscribe' throws beyond that.
+template<class... A>
+class async_event_stream<void(A...)>
+{
+    static_assert(!(... || (std::is_lvalue_reference<A>::value
+        && !std::is_const<typename std::remove_reference<A>::type>::value)),
+        "async_event_stream, handlers can't write back through reference parameters");
+
+    typedef std::tuple<typename std::decay<A>::type...> event_type;
+
+    typedef concurrent_event_stream<void(A...)> stream_type;
+
+    enum : uint32_t
+    {
+        worker_bits = 6,
+        guid_bits = 32 - worker_bits,
+        guid_mask = (1u << guid_bits) - 1,
+    };
+
+    struct event_worker
+    {
+        event_worker(size_t capacity) :
+            _ring(capacity),
+            _signal(0),
+            _space(0)
+        {
+        }
+
+        event_stream_internal::event_ring<event_type> _ring;
+
+        stream_type _stream;
+
+        /// bumped on every push, the worker waits on it when the ring is empty
+        std::atomic<uint32_t> _signal;
+
+        /// bumped on every pop, a blocked emitter waits on it
+        std::atomic<uint32_t> _space;
+
+        std::thread _thread;
+    };
+public:
+    typedef typename stream_type::func_type func_type;
+
+    async_event_stream(uint32_t worker_count = 1, size_t queue_capacity = 1024,
+        event_backpressure policy = event_backpressure::block) :
+        _policy(policy),
+        _next_worker(0),
+        _dropped(0),
+        _stopped(false)
+    {
+        if (worker_count == 0)
+            throw std::logic_error("async_event_stream, no worker");
+
+        if (worker_count > (1u << worker_bits))
+            throw std::logic_error("async_event_stream, too many workers");
+
+        for (uint32_t i = 0; i < worker_count; i++) {
+            _workers.emplace_back(new event_worker(queue_capacity));
+        }
+        for (auto& worker : _workers) {
+            event_worker* w = worker.get();
+            w->_thread = std::thread([this, w] { run(*w); });
+        }
+    }
+
+    ~async_event_stream()
+    {
+        _stopped = true;
+        for (auto& worker : _workers) {
+            worker->_signal.fetch_add(1, std::memory_order_release);
+            worker->_signal.notify_one();
+        }
+        for (auto& worker : _workers) {
+            worker->_thread.join();
+        }
+    }
+
+    /// safe from any thread, the returned guid encodes the worker
+    uint32_t subscribe(func_type t)
+    {
+        if (!t) return 0;
+
+        uint32_t index = _next_worker.fetch_add(1, std::memory_order_relaxed) % worker_count();
+        auto& stream = _workers[index]->_stream;
+        uint32_t guid = stream.subscribe(std::move(t));
+        if (guid > guid_mask) {
+            stream.unsubscribe(guid);
+            throw std::length_error("async_event_stream, too many subscriptions");
+        }
+        return guid | (index << guid_bits);
+    }
+
+    /// the handler may still run for events queued before this call
+    void unsubscribe(uint32_t guid)
+    {
+        if (guid == 0) return;
+
+        uint32_t index = guid >> guid_bits;
+        if (index >= worker_count()) return;
+
+        _workers[index]->_stream.unsubscribe(guid & guid_mask);
+    }
+
+    void emit(A... args)
+    {
+        event_worker* last = nullptr;
+        for (auto& worker : _workers) {
+            if (worker->_stream.size() == 0) continue;
+
+            if (last) {
+                enqueue(*last, event_type(args...));
+            }
+            last = worker.get();
+        }
+
+        if (last) {
+            enqueue(*last, event_type(std::forward<A>(args)...));
+        }
+    }
+
+    uint32_t worker_count() const
+    {
+        return uint32_t(_workers.size());
+    }
+
+    /// events waiting in all rings, approximate while emitting
+    size_t queue_depth() const
+    {
+        size_t depth = 0;
+        for (auto& worker : _workers) {
+            depth += worker->_ring.size();
+        }
+        return depth;
+    }
+
+    /// events thrown away by drop_oldest or drop_newest, counted once per worker
+    uint64_t dropped() const
+    {
+        return _dropped.load(std::memory_order_relaxed);
+    }
+private:
+    void enqueue(event_worker& worker, event_type&& ev)
+    {
+        switch (_policy) {
+        case event_backpressure::block:
+            for (;;) {
+                uint32_t space = worker._space.load(std::memory_order_acquire);
+                if (worker._ring.try_push(std::move(ev))) break;
+
+                worker._space.wait(space, std::memory_order_acquire);
+            }
+            break;
+        case event_backpressure::drop_oldest:
+            while (!worker._ring.try_push(std::move(ev))) {
+                std::optional<event_type> oldest;
+                if (worker._ring.try_pop(oldest)) {
+                    _dropped.fetch_add(1, std::memory_order_relaxed);
+                }
+            }
+            break;
+        case event_backpressure::drop_newest:
+            if (!worker._ring.try_push(std::move(ev))) {
+                _dropped.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            break;
+        }
+
+        worker._signal.fetch_add(1, std::memory_order_release);
+        worker._signal.notify_one();
+    }
+
+    void run(event_worker& worker)
+    {
+        std::optional<event_type> ev;
+        for (;;) {
+            uint32_t signal = worker._signal.load(std::memory_order_acquire);
+            if (worker._ring.try_pop(ev)) {
+                worker._space.fetch_add(1, std::memory_order_release);
+                worker._space.notify_all();
+
+                std::apply([&](auto&... args) { worker._stream.emit(std::move(args)...); }, *ev);
+                ev.reset();
+                continue;
+            }
+
+            if (_stopped) break;
+
+            worker._signal.wait(signal, std::memory_order_acquire);
+        }
+    }
+
+    std::vector<std::unique_ptr<event_worker>> _workers;
+
+    event_backpressure _policy;
+
+    std::atomic<uint32_t> _next_worker;
+
+    std::atomic<uint64_t> _dropped;
+
+    std::atomic<bool> _stopped;
+private:
+    async_event_stream(const async_event_stream&);
+    async_event_stream& operator=(const async_event_stream&);
+};
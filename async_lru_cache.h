@@ -0,0 +1,197 @@
+#pragma once
+#include "lru_cache.h"
+#include "coro.h"
+#include <mutex>
+#include <vector>
+#include <unordered_map>
+#include <exception>
+
+/// lru_cache whose creator is a coroutine, query never blocks the awaiting thread.
+///
+/// creator sample:
+///
+///     co::task<bool> load_texture(const std::string& path, texture*& tex);
+///
+/// usage:
+///
+///     texture* tex = nullptr;
+///     bool ok = co_await co::call_coro(&async_lru_cache<std::string, texture*>::query, &cache, path, tex);
+///
+/// concurrent misses of the same key share one creator call, the one that started it
+/// resumes the others when it completes, a creator exception is rethrown to all of them.
+///
+/// by default the waiters are resumed inline, one after another on the loader's stack,
+/// each runs until its next suspension before the next one (and the loader) goes on.
+/// with many waiters give an executor (see coro_executor.h) to 'set_executor', the
+/// waiters are then posted to it and the loader goes on right away.
+template<class K, class V, class H = std::hash<typename lru_cache_key_view<K>::type>>
+class async_lru_cache
+{
+    typedef std::function<co::task<bool>(const K&, V&)> creator_type;
+
+    struct lru_cache_flight
+    {
+        bool _done = false;
+
+        bool _success = false;
+
+        V _val;
+
+        std::exception_ptr _exc;
+
+        std::vector<std::coroutine_handle<>> _waiters;
+    };
+
+    struct flight_awaiter
+    {
+        bool await_ready() {
+            return false;
+        }
+
+        bool await_suspend(std::coroutine_handle<> handle) {
+            std::lock_guard<std::mutex> lock{ _owner._mutex };
+            if (_flight->_done) {
+                return false;
+            }
+
+            _flight->_waiters.push_back(handle);
+            return true;
+        }
+
+        void await_resume() {
+        }
+
+        async_lru_cache& _owner;
+
+        lru_cache_flight* _flight;
+    };
+public:
+    template<class C, class D>
+    async_lru_cache(uint32_t max_cache_count, C creator, D deletor) :
+        _impl(new lru_cache_internal::lru_cache_impl<K, V, lru_cache_internal::null_creator<K, V>, D>(max_cache_count, {}, deletor)),
+        _creator(creator)
+    {
+    }
+
+    template<class C>
+    async_lru_cache(uint32_t max_cache_count, C creator) :
+        _impl(new lru_cache_internal::lru_cache_impl<K, V, lru_cache_internal::null_creator<K, V>>(max_cache_count)),
+        _creator(creator)
+    {
+    }
+
+    ~async_lru_cache()
+    {
+        delete _impl;
+    }
+
+    co::task<bool> query(const K& k, V& v)
+    {
+        std::shared_ptr<lru_cache_flight> flight;
+        bool loader = false;
+        {
+            std::lock_guard<std::mutex> lock{ _mutex };
+            if (_impl->find(k, v)) co_return true;
+
+            auto iter = _flights.find(k);
+            if (iter != _flights.end()) {
+                flight = iter->second;
+            } else {
+                flight = std::make_shared<lru_cache_flight>();
+                _flights.emplace(k, flight);
+                loader = true;
+            }
+        }
+
+        if (!loader) {
+            co_await flight_awaiter{ *this, flight.get() };
+
+            if (flight->_exc) std::rethrow_exception(flight->_exc);
+            if (flight->_success) v = flight->_val;
+            co_return flight->_success;
+        }
+
+        try {
+            flight->_success = co_await co::call_coro(_creator, k, v);
+        } catch (...) {
+            flight->_exc = std::current_exception();
+        }
+
+        std::vector<std::coroutine_handle<>> waiters;
+        void (*post)(void* executor, std::coroutine_handle<> handle);
+        void* executor;
+        {
+            std::lock_guard<std::mutex> lock{ _mutex };
+            if (flight->_success) {
+                flight->_val = v;
+                _impl->insert(k, v);
+            }
+
+            flight->_done = true;
+            _flights.erase(k);
+            waiters.swap(flight->_waiters);
+            post = _post;
+            executor = _executor;
+        }
+
+        for (auto handle : waiters) {
+            if (post) {
+                post(executor, handle);
+            } else {
+                handle.resume();
+            }
+        }
+
+        if (flight->_exc) std::rethrow_exception(flight->_exc);
+        co_return flight->_success;
+    }
+
+    /// waiters of a load are posted to executor instead of resumed on the loader's stack,
+    /// executor must outlive the cache
+    template<class Executor>
+    void set_executor(Executor& executor)
+    {
+        std::lock_guard<std::mutex> lock{ _mutex };
+        _executor = &executor;
+        _post = [](void* executor, std::coroutine_handle<> handle) {
+            static_cast<Executor*>(executor)->post(handle);
+        };
+    }
+
+    void clear()
+    {
+        std::lock_guard<std::mutex> lock{ _mutex };
+        _impl->clear();
+    }
+
+    uint32_t size() const
+    {
+        std::lock_guard<std::mutex> lock{ _mutex };
+        return _impl->size();
+    }
+
+    /// creator latency isn't recorded, the creator runs outside the impl
+    lru_cache_stats stats() const
+    {
+        std::lock_guard<std::mutex> lock{ _mutex };
+        lru_cache_stats s;
+        _impl->stats(s);
+        return s;
+    }
+private:
+    mutable std::mutex _mutex;
+
+    lru_cache_internal::lru_cache_interface<K, V>* _impl;
+
+    creator_type _creator;
+
+    std::unordered_map<K, std::shared_ptr<lru_cache_flight>, H> _flights;
+
+    void (*_post)(void* executor, std::coroutine_handle<> handle) = nullptr;
+
+    void* _executor = nullptr;
+private:
+    async_lru_cache(const async_lru_cache&);
+
+    async_lru_cache& operator=(const async_lru_cache&);
+};
@@ -0,0 +1,154 @@
+/// query throughput from 1 to 64 threads of one lru_cache behind a single mutex
+/// against concurrent_lru_cache with 64 shards. keys are uniform over twice the
+/// capacity, so about half of the queries miss and evict.
+///
+/// then 32 threads miss the same keys at once with a slow creator, in normal and
+/// in single_flight mode. every key must be created once and every thread must
+/// see the exception of a failing creator, the exit code is 1 otherwise.
+///
+///     cl /O2 /std:c++20 /EHsc /I.. concurrent_lru_cache_bench.cpp
+///     concurrent_lru_cache_bench [queries per thread, default 1000000]
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "concurrent_lru_cache.h"
+
+enum : uint32_t {
+    capacity = 100000,
+    shard_count = 64,
+};
+
+static uint64_t next_random(uint64_t& state) {
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return state;
+}
+
+static bool identity_creator(const uint64_t& k, uint64_t& v) {
+    v = k;
+    return true;
+}
+
+/// millions of queries per second over all threads
+template<class F>
+static double measure(uint32_t thread_count, uint32_t queries, F query) {
+    std::vector<std::thread> threads;
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t t = 0; t < thread_count; t++) {
+        threads.emplace_back([&, t] {
+            uint64_t state = 88172645463325252ull + t;
+            for (uint32_t i = 0; i < queries; i++) {
+                query(next_random(state) % (capacity * 2));
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    return double(thread_count) * queries / double(std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count());
+}
+
+/// keys divisible by 10 fail, the others take about 1ms to create
+static bool slow_creator(std::atomic<uint32_t>* calls, const uint64_t& k, uint64_t& v) {
+    calls[k].fetch_add(1, std::memory_order_relaxed);
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    if (k % 10 == 0)
+        throw std::runtime_error("creator failed");
+
+    v = k;
+    return true;
+}
+
+/// true when every key that succeeds was created once and every failure reached every thread
+static bool contention(const char* name, concurrent_lru_cache_mode mode) {
+    enum : uint32_t {
+        key_count = 200,
+        thread_count = 32,
+    };
+
+    std::atomic<uint32_t> calls[key_count];
+    for (auto& count : calls) {
+        count = 0;
+    }
+
+    auto creator = [&calls](const uint64_t& k, uint64_t& v) { return slow_creator(calls, k, v); };
+    concurrent_lru_cache<uint64_t, uint64_t> cache(key_count, 4, creator, mode);
+
+    std::atomic<bool> go{ false };
+    std::atomic<uint32_t> failures{ 0 };
+    std::vector<std::thread> threads;
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t t = 0; t < thread_count; t++) {
+        threads.emplace_back([&] {
+            while (!go) {
+                std::this_thread::yield();
+            }
+            for (uint64_t k = 0; k < key_count; k++) {
+                uint64_t v = 0;
+                try {
+                    cache.query(k, v);
+                } catch (const std::runtime_error&) {
+                    failures.fetch_add(1, std::memory_order_relaxed);
+                }
+            }
+        });
+    }
+    go = true;
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+
+    uint32_t created = 0;
+    uint32_t duplicated = 0;
+    for (uint64_t k = 0; k < key_count; k++) {
+        if (k % 10 == 0) continue;
+
+        created++;
+        duplicated += calls[k] - 1;
+    }
+
+    bool passed = duplicated == 0 && failures == key_count / 10 * thread_count;
+    printf("%-13s  %3u keys created, %u duplicate creator calls, %4u failures seen, %5lld ms   %s\n",
+        name, created, duplicated, failures.load(),
+        (long long)std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count(),
+        passed ? "ok" : "FAILED");
+    return passed;
+}
+
+int main(int argc, char* argv[]) {
+    uint32_t queries = argc > 1 ? uint32_t(strtoul(argv[1], nullptr, 10)) : 1000000;
+
+    printf("threads   mutex Mq/s   sharded Mq/s\n");
+    for (uint32_t thread_count = 1; thread_count <= 64; thread_count *= 2) {
+        std::mutex mutex;
+        lru_cache<uint64_t, uint64_t> locked(capacity, &identity_creator);
+        double single = measure(thread_count, queries, [&](uint64_t k) {
+            uint64_t v;
+            std::lock_guard<std::mutex> lock{ mutex };
+            locked.query(k, v);
+        });
+
+        concurrent_lru_cache<uint64_t, uint64_t> sharded(capacity, shard_count, &identity_creator);
+        double concurrent = measure(thread_count, queries, [&](uint64_t k) {
+            uint64_t v;
+            sharded.query(k, v);
+        });
+
+        printf("%7u   %10.2f   %12.2f\n", thread_count, single, concurrent);
+    }
+
+    printf("\n");
+    bool passed = contention("normal", concurrent_lru_cache_mode::normal);
+    passed = contention("single_flight", concurrent_lru_cache_mode::single_flight) && passed;
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,135 @@
+/// cost of coroutine plumbing in coro.h.
+///
+///     round trip  co_await of co::run_async on a function that calls its
+///                 callback right away, the awaiter state, the callback and the
+///                 suspend handshake without any real asynchrony
+///     chain       a task awaiting a task 10,000 deep, each level creates,
+///                 enters and returns from one task
+///     frames      tasks awaited one after another, frames from the per-thread
+///                 pool against std::allocator through std::allocator_arg, i.e.
+///                 operator new, with the operator new calls per task
+///
+///     cl /O2 /std:c++20 /EHsc /I.. coro_bench.cpp
+///     coro_bench [round trips, default 10000000]
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <new>
+#include <tuple>
+
+#include "coro.h"
+
+static std::atomic<uint64_t> allocations{ 0 };
+
+void* operator new(size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* block = malloc(size ? size : 1)) {
+        return block;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* block) noexcept {
+    free(block);
+}
+
+void operator delete(void* block, size_t) noexcept {
+    free(block);
+}
+
+/// completes synchronously, inside await_suspend
+struct sync_source {
+    template<class F>
+    void operator()(uint32_t x, F&& done) const {
+        done(x + 1);
+    }
+};
+
+static co::task<uint64_t> round_trips(uint32_t count) {
+    uint64_t sum = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        auto [v] = co_await co::run_async<uint32_t>(sync_source{}, i);
+        sum += v;
+    }
+    co_return sum;
+}
+
+enum : uint32_t {
+    chain_depth = 10000,
+    chain_count = 100,
+};
+
+static co::task<uint64_t> chain(uint32_t depth) {
+    if (depth == 0) {
+        co_return 0;
+    }
+    uint64_t below = co_await co::call_coro(chain, depth - 1);
+    co_return below + 1;
+}
+
+static co::task<uint64_t> chains() {
+    uint64_t sum = 0;
+    for (uint32_t i = 0; i < chain_count; i++) {
+        sum += co_await co::call_coro(chain, uint32_t(chain_depth));
+    }
+    co_return sum;
+}
+
+static co::task<uint32_t> pooled_leaf(uint32_t x) {
+    co_return x + 1;
+}
+
+static co::task<uint32_t> heap_leaf(std::allocator_arg_t, std::allocator<char>, uint32_t x) {
+    co_return x + 1;
+}
+
+static co::task<uint64_t> pooled_leaves(uint32_t count) {
+    uint64_t sum = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        sum += co_await pooled_leaf(i);
+    }
+    co_return sum;
+}
+
+static co::task<uint64_t> heap_leaves(uint32_t count) {
+    uint64_t sum = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        sum += co_await heap_leaf(std::allocator_arg, std::allocator<char>(), i);
+    }
+    co_return sum;
+}
+
+static double nanoseconds(std::chrono::steady_clock::duration elapsed, uint64_t count) {
+    return double(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()) / double(count);
+}
+
+int main(int argc, char* argv[]) {
+    uint32_t count = argc > 1 ? uint32_t(strtoul(argv[1], nullptr, 10)) : 10000000;
+
+    auto start = std::chrono::steady_clock::now();
+    uint64_t sum = co::run_coro(round_trips, count).get();
+    printf("round trip   %7.1f ns per co_await   (%llu)\n",
+        nanoseconds(std::chrono::steady_clock::now() - start, count), (unsigned long long)(sum & 1));
+
+    start = std::chrono::steady_clock::now();
+    sum = co::run_coro(chains).get();
+    double level = nanoseconds(std::chrono::steady_clock::now() - start, uint64_t(chain_depth) * chain_count);
+    printf("chain        %7.1f ns per level, %7.1f us per %u deep chain   (%s)\n",
+        level, level * double(chain_depth) / 1e3, uint32_t(chain_depth),
+        sum == uint64_t(chain_depth) * chain_count ? "ok" : "FAILED");
+
+    for (int heap = 0; heap < 2; heap++) {
+        /// the driving task and the future are counted too, they are amortized
+        uint64_t before = allocations.load();
+        start = std::chrono::steady_clock::now();
+        sum = co::run_coro(heap ? heap_leaves : pooled_leaves, count).get();
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        printf("frames %-6s %5.2f M tasks/s, %.3f operator new per task   (%llu)\n",
+            heap ? "new" : "pooled", 1e3 / nanoseconds(elapsed, count),
+            double(allocations.load() - before) / double(count), (unsigned long long)(sum & 1));
+    }
+    return 0;
+}
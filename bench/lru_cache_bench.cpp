@@ -0,0 +1,87 @@
+/// lookup cost of lru_cache (map index, one heap node per entry) against
+/// lru_cache_hashed (open-addressing index over a preallocated slab) with
+/// 1K, 100K and 10M cached entries.
+///
+///     hit   query of a cached key, keys in random order
+///     miss  query of a key never cached, the creator runs and the lru entry is evicted
+///
+///     cl /O2 /std:c++20 /EHsc /I.. lru_cache_bench.cpp
+///     lru_cache_bench [max entries, default 10000000]
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <vector>
+
+#include "lru_cache.h"
+
+static uint64_t next_random(uint64_t& state) {
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return state;
+}
+
+static bool identity_creator(const uint64_t& k, uint64_t& v) {
+    v = k;
+    return true;
+}
+
+/// nanoseconds per query
+template<class F>
+static double measure(uint32_t count, F query) {
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < count; i++) {
+        query(i);
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    return double(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()) / count;
+}
+
+static void run(const char* name, uint32_t entries, lru_cache<uint64_t, uint64_t>& cache) {
+    for (uint64_t k = 0; k < entries; k++) {
+        cache.insert(k, k);
+    }
+
+    uint32_t count = entries < 1000000 ? 1000000 : entries;
+    std::vector<uint64_t> keys(count);
+    uint64_t state = 88172645463325252ull;
+    for (auto& k : keys) {
+        k = next_random(state) % entries;
+    }
+
+    uint64_t sum = 0;
+    double hit = measure(count, [&](uint32_t i) {
+        uint64_t v = 0;
+        cache.query(keys[i], v);
+        sum += v;
+    });
+
+    /// above every cached key, each query misses and evicts
+    double miss = measure(count, [&](uint32_t i) {
+        uint64_t v = 0;
+        cache.query(uint64_t(entries) + i, v);
+        sum += v;
+    });
+
+    printf("%-8s %10u entries   hit %7.1f ns   miss %7.1f ns   (%llu)\n",
+        name, entries, hit, miss, (unsigned long long)(sum & 1));
+}
+
+int main(int argc, char* argv[]) {
+    uint32_t max_entries = argc > 1 ? uint32_t(strtoul(argv[1], nullptr, 10)) : 10000000;
+
+    for (uint32_t entries : { 1000u, 100000u, 10000000u }) {
+        if (entries > max_entries) break;
+
+        {
+            lru_cache<uint64_t, uint64_t> cache(entries, &identity_creator);
+            run("map", entries, cache);
+        }
+        {
+            lru_cache<uint64_t, uint64_t> cache(entries, &identity_creator, lru_cache_hashed);
+            run("hashed", entries, cache);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,108 @@
+/// replays request traces through lru_cache with lru_cache_lru_policy and with
+/// lru_cache_slru_policy and reports hit ratio and queries per second.
+///
+///     zipf  1M queries over 100K keys, zipfian with s = 0.99
+///     scan  the same, every 100K queries a batch job reads 20K keys once each
+///
+/// the cache holds 5K entries.
+///
+///     cl /O2 /std:c++20 /EHsc /I.. lru_policy_bench.cpp
+#include <stdint.h>
+#include <stdio.h>
+#include <math.h>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+#include "lru_cache.h"
+
+enum : uint32_t {
+    capacity = 5000,
+    key_count = 100000,
+    query_count = 1000000,
+    scan_interval = 100000,
+    scan_length = 20000,
+};
+
+static uint64_t next_random(uint64_t& state) {
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return state;
+}
+
+/// key 0 is the most popular
+static std::vector<uint64_t> zipf_trace(uint64_t seed) {
+    std::vector<double> cdf(key_count);
+    double sum = 0;
+    for (uint32_t i = 0; i < key_count; i++) {
+        sum += 1.0 / pow(double(i + 1), 0.99);
+        cdf[i] = sum;
+    }
+
+    std::vector<uint64_t> trace(query_count);
+    uint64_t state = seed;
+    for (auto& k : trace) {
+        double u = double(next_random(state) >> 11) / double(1ull << 53) * sum;
+        k = uint64_t(std::lower_bound(cdf.begin(), cdf.end(), u) - cdf.begin());
+    }
+    return trace;
+}
+
+/// scan keys are above the zipf keys and never repeat
+static std::vector<uint64_t> scan_trace(uint64_t seed) {
+    std::vector<uint64_t> zipf = zipf_trace(seed);
+    std::vector<uint64_t> trace;
+    uint64_t scan_key = key_count;
+    for (uint32_t i = 0; i < query_count; i++) {
+        if (i % scan_interval == 0) {
+            for (uint32_t j = 0; j < scan_length; j++) {
+                trace.push_back(scan_key++);
+            }
+        }
+        trace.push_back(zipf[i]);
+    }
+    return trace;
+}
+
+struct counting_creator {
+    bool operator()(const uint64_t& k, uint64_t& v) {
+        (*_misses)++;
+        v = k;
+        return true;
+    }
+
+    uint64_t* _misses;
+};
+
+template<class P>
+static void replay(const char* trace_name, const char* policy_name, const std::vector<uint64_t>& trace, P policy) {
+    uint64_t misses = 0;
+    lru_cache<uint64_t, uint64_t> cache(capacity, counting_creator{ &misses },
+        lru_cache_internal::do_nothing_deletor<uint64_t>(), policy);
+
+    uint64_t sum = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (uint64_t k : trace) {
+        uint64_t v = 0;
+        cache.query(k, v);
+        sum += v;
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+
+    double seconds = double(std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count()) / 1e6;
+    printf("%-5s %-5s   hit ratio %5.1f%%   %6.2f M queries/s   (%llu)\n", trace_name, policy_name,
+        100.0 * double(trace.size() - misses) / double(trace.size()), double(trace.size()) / seconds / 1e6,
+        (unsigned long long)(sum & 1));
+}
+
+int main() {
+    std::vector<uint64_t> zipf = zipf_trace(88172645463325252ull);
+    replay("zipf", "lru", zipf, lru_cache_lru_policy());
+    replay("zipf", "slru", zipf, lru_cache_slru_policy());
+
+    std::vector<uint64_t> scan = scan_trace(88172645463325252ull);
+    replay("scan", "lru", scan, lru_cache_lru_policy());
+    replay("scan", "slru", scan, lru_cache_slru_policy());
+    return 0;
+}
@@ -0,0 +1,107 @@
+/// cost of an l1 miss in tiered_lru_cache when the l2 store has the value
+/// against one that falls through to the creator, with 4KB string values.
+///
+///     creator  every key queried for the first time, the creator runs and the
+///              evicted entry is demoted
+///     l2 hit   the same keys again in random order, each misses l1 and is
+///              promoted from the store, the evicted entry is demoted
+///
+/// the creator spins for a given time to stand in for a remote fetch, 0 leaves
+/// only the cost of building the value.
+///
+///     cl /O2 /std:c++20 /EHsc /I.. tiered_lru_cache_bench.cpp
+///     tiered_lru_cache_bench [creator microseconds, default 50]
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "tiered_lru_cache.h"
+
+enum : uint32_t {
+    l1_capacity = 1000,
+    key_count = 10000,
+    value_size = 4096,
+};
+
+static uint64_t next_random(uint64_t& state) {
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return state;
+}
+
+/// text-like, so the compressed store has something to compress
+struct page_creator {
+    bool operator()(const uint64_t& k, std::string& v) {
+        auto until = std::chrono::steady_clock::now() + std::chrono::microseconds(_micros);
+        while (std::chrono::steady_clock::now() < until) {
+        }
+
+        v.clear();
+        char line[64];
+        for (uint32_t i = 0; v.size() < value_size; i++) {
+            v.append(line, size_t(snprintf(line, sizeof(line), "page %llu line %u\n", (unsigned long long)k, i)));
+        }
+        v.resize(value_size);
+        return true;
+    }
+
+    uint32_t _micros;
+};
+
+/// microseconds per query
+template<class S>
+static void run(const char* name, S* store, uint32_t micros, const std::vector<uint64_t>& keys) {
+    tiered_lru_cache<uint64_t, std::string, S> cache(l1_capacity, store, page_creator{ micros });
+
+    uint64_t sum = 0;
+    std::string v;
+    auto start = std::chrono::steady_clock::now();
+    for (uint64_t k = 0; k < key_count; k++) {
+        cache.query(k, v);
+        sum += uint8_t(v[5]);
+    }
+    auto created = std::chrono::steady_clock::now() - start;
+
+    uint64_t promotions = cache.promotions();
+    start = std::chrono::steady_clock::now();
+    for (uint64_t k : keys) {
+        cache.query(k, v);
+        sum += uint8_t(v[5]);
+    }
+    auto promoted = std::chrono::steady_clock::now() - start;
+
+    printf("%-10s  creator %8.2f us   l2 hit %8.2f us   %u of %u promoted   (%llu)\n", name,
+        double(std::chrono::duration_cast<std::chrono::nanoseconds>(created).count()) / 1e3 / double(key_count),
+        double(std::chrono::duration_cast<std::chrono::nanoseconds>(promoted).count()) / 1e3 / keys.size(),
+        uint32_t(cache.promotions() - promotions), uint32_t(keys.size()), (unsigned long long)(sum & 1));
+}
+
+int main(int argc, char* argv[]) {
+    uint32_t micros = argc > 1 ? uint32_t(strtoul(argv[1], nullptr, 10)) : 50;
+
+    /// every key once, none of them in l1 at the start
+    std::vector<uint64_t> keys(key_count);
+    for (uint64_t k = 0; k < key_count; k++) {
+        keys[k] = k;
+    }
+    uint64_t state = 88172645463325252ull;
+    for (uint32_t i = key_count - 1; i > 0; i--) {
+        std::swap(keys[i], keys[next_random(state) % (i + 1)]);
+    }
+    std::vector<uint64_t> l2_keys;
+    for (uint64_t k : keys) {
+        if (k < key_count - l1_capacity) {
+            l2_keys.push_back(k);
+        }
+    }
+
+    printf("creator spins %u us, %u byte values, l1 holds %u of %u keys\n", micros, value_size, l1_capacity, key_count);
+    run("compressed", new lru_cache_compressed_store<uint64_t>(1ull << 30), micros, l2_keys);
+    run("file", new lru_cache_file_store<uint64_t>("tiered_lru_cache_bench.l2", 1ull << 30), micros, l2_keys);
+    remove("tiered_lru_cache_bench.l2");
+    return 0;
+}
@@ -0,0 +1,193 @@
+#pragma once
+#include "event_stream.h"
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+template<class T>
+class concurrent_event_stream
+{
+};
+
+/// event_stream for many emitting threads. 'emit' takes no lock, it pins the
+/// current immutable observer snapshot and calls the handlers from it, so
+/// emitters never wait for each other. 'subscribe'/'unsubscribe' copy the
+/// snapshot under a writer lock and publish the copy.
+///
+/// a snapshot is freed by whoever drops its last reference. between loading the
+/// snapshot pointer and taking a reference a reader is counted in the reader slot
+/// of the current epoch, a writer publishing a new snapshot flips the epoch and
+/// waits for the old slot to drain before dropping its reference to the old
+/// snapshot, that window is a few instructions, never a handler call.
+///
+/// an emit racing with 'unsubscribe' may still call the handler once after
+/// 'unsubscribe' returned, the handler is destroyed with the last snapshot holding
+/// it, possibly on an emitting thread. handlers may emit, subscribe and
+/// unsubscribe. the stream must outlive all emits.
+template<class... A>
+class concurrent_event_stream<void(A...)>
+{
+public:
+    typedef event_function<void(typename event_param<A>::type...)> func_type;
+private:
+    struct event_observer
+    {
+        func_type _handler;
+
+        uint32_t _guid;
+    };
+
+    struct event_snapshot
+    {
+        std::atomic<uint32_t> _refs;
+
+        std::vector<std::shared_ptr<const event_observer>> _observers;
+    };
+
+    /// pinned snapshot, released on scope exit
+    class snapshot_guard
+    {
+    public:
+        snapshot_guard(event_snapshot* snapshot) :
+            _snapshot(snapshot)
+        {
+        }
+
+        ~snapshot_guard()
+        {
+            release(_snapshot);
+        }
+
+        event_snapshot* _snapshot;
+    private:
+        snapshot_guard(const snapshot_guard&);
+        snapshot_guard& operator=(const snapshot_guard&);
+    };
+public:
+    concurrent_event_stream() :
+        _guid_index(10000),
+        _epoch(0)
+    {
+        _readers[0] = 0;
+        _readers[1] = 0;
+
+        auto snapshot = new event_snapshot;
+        snapshot->_refs = 1;
+        _snapshot = snapshot;
+    }
+
+    ~concurrent_event_stream()
+    {
+        release(_snapshot.load());
+    }
+
+    uint32_t subscribe(func_type t)
+    {
+        if (!t) return 0;
+
+        auto ob = std::make_shared<event_observer>();
+        ob->_handler = std::move(t);
+
+        std::lock_guard<std::mutex> lock{ _mutex };
+        ob->_guid = _guid_index++;
+
+        auto snapshot = new event_snapshot;
+        snapshot->_refs = 1;
+        snapshot->_observers = _snapshot.load(std::memory_order_relaxed)->_observers;
+        snapshot->_observers.push_back(std::move(ob));
+
+        uint32_t guid = snapshot->_observers.back()->_guid;
+        publish(snapshot);
+        return guid;
+    }
+
+    void unsubscribe(uint32_t guid)
+    {
+        if (guid == 0) return;
+
+        std::lock_guard<std::mutex> lock{ _mutex };
+        auto& observers = _snapshot.load(std::memory_order_relaxed)->_observers;
+        auto iter = std::find_if(observers.begin(), observers.end(),
+            [=](const std::shared_ptr<const event_observer>& ob) { return ob->_guid == guid; });
+        if (iter == observers.end()) return;
+
+        auto snapshot = new event_snapshot;
+        snapshot->_refs = 1;
+        snapshot->_observers.reserve(observers.size() - 1);
+        snapshot->_observers.insert(snapshot->_observers.end(), observers.begin(), iter);
+        snapshot->_observers.insert(snapshot->_observers.end(), iter + 1, observers.end());
+        publish(snapshot);
+    }
+
+    void emit(A... args)
+    {
+        snapshot_guard guard(acquire());
+        for (auto& ob : guard._snapshot->_observers) {
+            ob->_handler(args...);
+        }
+    }
+
+    /// subscribers as of now, may be stale by the time it returns
+    size_t size() const
+    {
+        snapshot_guard guard(const_cast<concurrent_event_stream*>(this)->acquire());
+        return guard._snapshot->_observers.size();
+    }
+private:
+    event_snapshot* acquire()
+    {
+        for (;;) {
+            uint32_t epoch = _epoch.load(std::memory_order_seq_cst);
+            auto& readers = _readers[epoch & 1];
+            readers.fetch_add(1, std::memory_order_seq_cst);
+
+            /// a writer flipped the epoch in between and may not wait for this slot
+            if (_epoch.load(std::memory_order_seq_cst) != epoch) {
+                readers.fetch_sub(1, std::memory_order_release);
+                continue;
+            }
+
+            auto snapshot = _snapshot.load(std::memory_order_seq_cst);
+            snapshot->_refs.fetch_add(1, std::memory_order_relaxed);
+            readers.fetch_sub(1, std::memory_order_release);
+            return snapshot;
+        }
+    }
+
+    static void release(event_snapshot* snapshot)
+    {
+        if (snapshot->_refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            delete snapshot;
+        }
+    }
+
+    /// called under _mutex
+    void publish(event_snapshot* snapshot)
+    {
+        auto old = _snapshot.exchange(snapshot, std::memory_order_seq_cst);
+        uint32_t epoch = _epoch.fetch_add(1, std::memory_order_seq_cst);
+
+        /// readers still counted in the old slot may hold old without a reference yet.
+        /// seq_cst like the reader's increment and epoch check, with acquire this load
+        /// could miss a reader that read the old epoch and go on to free old
+        while (_readers[epoch & 1].load(std::memory_order_seq_cst) != 0) {
+            std::this_thread::yield();
+        }
+
+        release(old);
+    }
+
+    std::mutex _mutex;
+
+    uint32_t _guid_index;
+
+    std::atomic<event_snapshot*> _snapshot;
+
+    std::atomic<uint32_t> _epoch;
+
+    std::atomic<uint32_t> _readers[2];
+private:
+    concurrent_event_stream(const concurrent_event_stream&);
+    concurrent_event_stream& operator=(const concurrent_event_stream&);
+};
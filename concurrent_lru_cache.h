@@ -0,0 +1,518 @@
+#pragma once
+#include "lru_cache.h"
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <unordered_map>
+#include <exception>
+#include <atomic>
+#include <chrono>
+
+enum class concurrent_lru_cache_mode
+{
+    /// creator runs under the shard lock, concurrent misses of one key each call it
+    normal,
+
+    /// creator runs outside the shard lock, concurrent misses of one key wait for
+    /// the first one and share its result (or its exception)
+    single_flight,
+};
+
+/// thread-safe lru_cache, keys are partitioned across independently locked shards,
+/// each shard is an ordinary lru_cache_impl with its own recency list and capacity.
+///
+/// creator and deletor are copied into every shard and run under that shard's lock,
+/// so they may be called concurrently for keys living in different shards. in
+/// single_flight mode creator runs unlocked and may be called concurrently for any
+/// two different keys.
+///
+/// a handle returned by query(k) may be released on any thread, the deletor of an
+/// evicted entry then runs on the releasing thread without any shard lock held.
+template<class K, class V, class H = std::hash<typename lru_cache_key_view<K>::type>>
+class concurrent_lru_cache
+{
+public:
+    typedef typename lru_cache_key_view<K>::type key_view;
+private:
+    struct lru_cache_flight
+    {
+        bool _done = false;
+
+        bool _success = false;
+
+        V _val;
+
+        /// set when the loader asked for a handle, waiters asking for one share it
+        lru_cache_handle<V> _handle;
+
+        std::exception_ptr _exc;
+    };
+
+    struct alignas(64) lru_cache_shard
+    {
+        mutable std::mutex _mutex;
+
+        lru_cache_internal::lru_cache_interface<K, V>* _impl = nullptr;
+
+        /// misses whose creator is running, single_flight mode only
+        std::unordered_map<K, std::shared_ptr<lru_cache_flight>, H> _flights;
+
+        std::condition_variable _cond;
+    };
+
+    /// finishes a flight however the loader leaves, so waiters never block on a
+    /// flight nobody will complete: marks it done and forgets it under the lock,
+    /// then wakes the waiters
+    struct flight_guard
+    {
+        ~flight_guard()
+        {
+            if (!_lock.owns_lock()) {
+                _lock.lock();
+            }
+            _flight->_done = true;
+            _shard._flights.erase(_key);
+            _lock.unlock();
+            _shard._cond.notify_all();
+        }
+
+        lru_cache_shard& _shard;
+
+        const K& _key;
+
+        lru_cache_flight* _flight;
+
+        std::unique_lock<std::mutex>& _lock;
+    };
+public:
+    template<class C, class D>
+    concurrent_lru_cache(uint32_t max_cache_count, uint32_t shard_count, C creator, D deletor,
+        concurrent_lru_cache_mode mode = concurrent_lru_cache_mode::normal)
+    {
+        init(max_cache_count, shard_count, mode);
+        for (uint32_t i = 0; i < _shard_count; i++) {
+            _shards[i]._impl = new lru_cache_internal::lru_cache_impl<K, V, C, D>(_shard_cache_count, creator, deletor);
+        }
+    }
+
+    template<class C, class D, class P>
+    concurrent_lru_cache(uint32_t max_cache_count, uint32_t shard_count, C creator, D deletor, P policy,
+        concurrent_lru_cache_mode mode = concurrent_lru_cache_mode::normal)
+    {
+        init(max_cache_count, shard_count, mode);
+        for (uint32_t i = 0; i < _shard_count; i++) {
+            _shards[i]._impl = new lru_cache_internal::lru_cache_impl<K, V, C, D,
+                lru_cache_internal::unit_weigher<V>, P>(_shard_cache_count, creator, deletor, policy);
+        }
+    }
+
+    template<class C>
+    concurrent_lru_cache(uint32_t max_cache_count, uint32_t shard_count, C creator,
+        concurrent_lru_cache_mode mode = concurrent_lru_cache_mode::normal)
+    {
+        init(max_cache_count, shard_count, mode);
+        for (uint32_t i = 0; i < _shard_count; i++) {
+            _shards[i]._impl = new lru_cache_internal::lru_cache_impl<K, V, C>(_shard_cache_count, creator);
+        }
+    }
+
+    template<class C, class D>
+    concurrent_lru_cache(uint32_t max_cache_count, uint32_t shard_count, C creator, D deletor, lru_cache_hashed_t,
+        concurrent_lru_cache_mode mode = concurrent_lru_cache_mode::normal)
+    {
+        init(max_cache_count, shard_count, mode);
+        for (uint32_t i = 0; i < _shard_count; i++) {
+            _shards[i]._impl = new lru_cache_internal::lru_cache_hash_impl<K, V, C, D, H>(_shard_cache_count, creator, deletor, _hasher);
+        }
+    }
+
+    template<class C>
+    concurrent_lru_cache(uint32_t max_cache_count, uint32_t shard_count, C creator, lru_cache_hashed_t,
+        concurrent_lru_cache_mode mode = concurrent_lru_cache_mode::normal)
+    {
+        init(max_cache_count, shard_count, mode);
+        for (uint32_t i = 0; i < _shard_count; i++) {
+            _shards[i]._impl = new lru_cache_internal::lru_cache_hash_impl<K, V, C,
+                typename lru_cache_internal::default_deletor<V>::type, H>(_shard_cache_count, creator,
+                typename lru_cache_internal::default_deletor<V>::type(), _hasher);
+        }
+    }
+
+    /// max_cache_count and max_weight are both split evenly across shards
+    template<class C, class D, class W>
+    concurrent_lru_cache(uint32_t max_cache_count, uint64_t max_weight, uint32_t shard_count, C creator, D deletor, W weigher,
+        concurrent_lru_cache_mode mode = concurrent_lru_cache_mode::normal)
+    {
+        init(max_cache_count, shard_count, mode);
+        uint64_t shard_weight = max_weight / _shard_count;
+        for (uint32_t i = 0; i < _shard_count; i++) {
+            _shards[i]._impl = new lru_cache_internal::lru_cache_impl<K, V, C, D, W>(_shard_cache_count, shard_weight, creator, deletor, weigher);
+        }
+    }
+
+    template<class C, class D, class W, class P>
+    concurrent_lru_cache(uint32_t max_cache_count, uint64_t max_weight, uint32_t shard_count, C creator, D deletor, W weigher, P policy,
+        concurrent_lru_cache_mode mode = concurrent_lru_cache_mode::normal)
+    {
+        init(max_cache_count, shard_count, mode);
+        uint64_t shard_weight = max_weight / _shard_count;
+        for (uint32_t i = 0; i < _shard_count; i++) {
+            _shards[i]._impl = new lru_cache_internal::lru_cache_impl<K, V, C, D, W, P>(_shard_cache_count, shard_weight, creator, deletor, weigher, policy);
+        }
+    }
+
+    ~concurrent_lru_cache()
+    {
+        for (uint32_t i = 0; i < _shard_count; i++) {
+            delete _shards[i]._impl;
+        }
+        delete[] _shards;
+    }
+
+    bool query(const key_view& k, V& v)
+    {
+        auto& shard = locate(k);
+        if (_mode == concurrent_lru_cache_mode::single_flight)
+            return query_single_flight(shard, k, v, nullptr);
+
+        std::lock_guard<std::mutex> lock{ shard._mutex };
+        return shard._impl->query(k, v);
+    }
+
+    /// pinned flavor, see lru_cache::query(k)
+    lru_cache_handle<V> query(const key_view& k)
+    {
+        lru_cache_handle<V> h;
+        auto& shard = locate(k);
+        if (_mode == concurrent_lru_cache_mode::single_flight) {
+            V v;
+            query_single_flight(shard, k, v, &h);
+            return h;
+        }
+
+        std::lock_guard<std::mutex> lock{ shard._mutex };
+        shard._impl->query(k, h);
+        return h;
+    }
+
+    /// same contract as lru_cache::query_many, takes each involved shard lock once
+    /// for the lookups and once for the inserts, batch_creator runs unlocked
+    template<class B>
+    uint32_t query_many(const std::vector<K>& keys, std::vector<V>& vals, std::vector<bool>& found, B batch_creator)
+    {
+        vals.assign(keys.size(), V());
+        found.assign(keys.size(), false);
+
+        std::vector<std::pair<uint32_t, size_t>> order(keys.size());
+        for (size_t i = 0; i < keys.size(); i++) {
+            order[i] = std::make_pair(shard_index(keys[i]), i);
+        }
+        std::sort(order.begin(), order.end());
+
+        uint32_t count = 0;
+        /// keys of any shard meet here, so they are told apart by the sharding hasher
+        lru_cache_internal::lru_cache_misses<K, V> misses;
+        std::unordered_map<K, size_t, H> index(keys.size(), _hasher);
+        for (size_t begin = 0, end = 0; begin < order.size(); begin = end) {
+            auto& shard = _shards[order[begin].first];
+            std::lock_guard<std::mutex> lock{ shard._mutex };
+
+            for (end = begin; end < order.size() && order[end].first == order[begin].first; end++) {
+                size_t i = order[end].second;
+                if (shard._impl->find(keys[i], vals[i])) {
+                    found[i] = true;
+                    count++;
+                } else {
+                    misses.add(index, keys[i], i);
+                }
+            }
+        }
+
+        if (misses.empty()) return count;
+
+        misses.create(batch_creator);
+
+        order.clear();
+        for (size_t i = 0; i < misses._keys.size(); i++) {
+            if (misses._created[i]) {
+                order.push_back(std::make_pair(shard_index(misses._keys[i]), i));
+            }
+        }
+        std::sort(order.begin(), order.end());
+
+        for (size_t begin = 0, end = 0; begin < order.size(); begin = end) {
+            auto& shard = _shards[order[begin].first];
+            std::lock_guard<std::mutex> lock{ shard._mutex };
+
+            for (end = begin; end < order.size() && order[end].first == order[begin].first; end++) {
+                size_t i = order[end].second;
+                shard._impl->insert(misses._keys[i], misses._vals[i]);
+            }
+        }
+
+        return count + misses.resolve(vals, found);
+    }
+
+    template<class B>
+    void prefetch(const std::vector<K>& keys, B batch_creator)
+    {
+        std::vector<V> vals;
+        std::vector<bool> found;
+        query_many(keys, vals, found, batch_creator);
+    }
+
+    void clear()
+    {
+        for (uint32_t i = 0; i < _shard_count; i++) {
+            std::lock_guard<std::mutex> lock{ _shards[i]._mutex };
+            _shards[i]._impl->clear();
+        }
+    }
+
+    uint32_t shard_count() const
+    {
+        return _shard_count;
+    }
+
+    uint32_t size() const
+    {
+        uint32_t size = 0;
+        for (uint32_t i = 0; i < _shard_count; i++) {
+            std::lock_guard<std::mutex> lock{ _shards[i]._mutex };
+            size += _shards[i]._impl->size();
+        }
+        return size;
+    }
+
+    uint64_t weight() const
+    {
+        uint64_t weight = 0;
+        for (uint32_t i = 0; i < _shard_count; i++) {
+            std::lock_guard<std::mutex> lock{ _shards[i]._mutex };
+            weight += _shards[i]._impl->weight();
+        }
+        return weight;
+    }
+
+    /// sum over all shards, each shard is read under its own lock so the
+    /// totals are not one atomic snapshot of the whole cache
+    lru_cache_stats stats() const
+    {
+        lru_cache_stats s;
+        for (uint32_t i = 0; i < _shard_count; i++) {
+            std::lock_guard<std::mutex> lock{ _shards[i]._mutex };
+            _shards[i]._impl->stats(s);
+        }
+        return s;
+    }
+
+    void insert(const K& k, const V& v)
+    {
+        auto& shard = locate(k);
+        std::lock_guard<std::mutex> lock{ shard._mutex };
+        shard._impl->insert(k, v);
+    }
+
+    void insert(K&& k, V&& v)
+    {
+        auto& shard = locate(k);
+        std::lock_guard<std::mutex> lock{ shard._mutex };
+        shard._impl->insert(std::move(k), std::move(v));
+    }
+
+    /// shard by shard under its lock, least recently used first within a shard
+    template<class F>
+    void for_each(F func) const
+    {
+        for (uint32_t i = 0; i < _shard_count; i++) {
+            std::lock_guard<std::mutex> lock{ _shards[i]._mutex };
+            _shards[i]._impl->for_each(func);
+        }
+    }
+
+    void set_default_ttl(std::chrono::milliseconds ttl)
+    {
+        for (uint32_t i = 0; i < _shard_count; i++) {
+            std::lock_guard<std::mutex> lock{ _shards[i]._mutex };
+            _shards[i]._impl->set_default_ttl(ttl);
+        }
+    }
+
+    /// reclaims up to max_count expired entries per shard, holding one shard lock at a time
+    uint32_t expire(uint32_t max_count)
+    {
+        uint32_t count = 0;
+        for (uint32_t i = 0; i < _shard_count; i++) {
+            std::lock_guard<std::mutex> lock{ _shards[i]._mutex };
+            count += _shards[i]._impl->expire(max_count);
+        }
+        return count;
+    }
+private:
+    /// fills h instead of v when h isn't null
+    bool query_single_flight(lru_cache_shard& shard, const key_view& kv, V& v, lru_cache_handle<V>* h)
+    {
+        std::unique_lock<std::mutex> lock{ shard._mutex };
+        if (h ? shard._impl->find(kv, *h) : shard._impl->find(kv, v)) return true;
+
+        auto&& k = lru_cache_internal::make_key<K>(kv);
+        auto iter = shard._flights.find(k);
+        if (iter != shard._flights.end()) {
+            auto flight = iter->second;
+            shard._cond.wait(lock, [&] { return flight->_done; });
+
+            if (flight->_exc) std::rethrow_exception(flight->_exc);
+            if (!flight->_success) return false;
+
+            if (h == nullptr) {
+                v = flight->_val;
+            } else if (flight->_handle) {
+                *h = flight->_handle;
+            } else if (!shard._impl->find(k, *h)) {
+                /// evicted before we woke up, its value may already be deleted
+                lock.unlock();
+                return query_single_flight(shard, kv, v, h);
+            }
+            return true;
+        }
+
+        auto flight = std::make_shared<lru_cache_flight>();
+        shard._flights.emplace(k, flight);
+        flight_guard guard{ shard, k, flight.get(), lock };
+
+        /// set_default_ttl writes it under the lock, create runs without
+        std::chrono::milliseconds ttl = shard._impl->default_ttl();
+        lock.unlock();
+
+        try {
+            flight->_success = shard._impl->create(k, v, ttl);
+        } catch (...) {
+            flight->_exc = std::current_exception();
+        }
+
+        lock.lock();
+        if (flight->_success) {
+            /// copying v, or a deletor run by the eviction, may throw too
+            try {
+                flight->_val = v;
+                if (h) {
+                    shard._impl->insert(k, v, ttl, *h);
+                    flight->_handle = *h;
+                } else {
+                    shard._impl->insert(k, v, ttl);
+                }
+            } catch (...) {
+                flight->_exc = std::current_exception();
+            }
+        }
+
+        if (flight->_exc) std::rethrow_exception(flight->_exc);
+        return flight->_success;
+    }
+
+    /// shard_count is rounded up to a power of two, 0 picks one from the hardware
+    void init(uint32_t max_cache_count, uint32_t shard_count, concurrent_lru_cache_mode mode)
+    {
+        _mode = mode;
+
+        if (shard_count == 0) {
+            shard_count = std::thread::hardware_concurrency() * 2;
+        }
+
+        _shard_count = 1;
+        while (_shard_count < shard_count) {
+            _shard_count <<= 1;
+        }
+
+        _shard_cache_count = (max_cache_count + _shard_count - 1) / _shard_count;
+        _shards = new lru_cache_shard[_shard_count];
+    }
+
+    lru_cache_shard& locate(const key_view& k)
+    {
+        return _shards[shard_index(k)];
+    }
+
+    uint32_t shard_index(const key_view& k) const
+    {
+        /// remix so shard selection doesn't correlate with the bucket bits used inside a shard
+        uint64_t h = uint64_t(_hasher(k));
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdull;
+        h ^= h >> 33;
+        return uint32_t(h & (_shard_count - 1));
+    }
+
+    lru_cache_shard* _shards = nullptr;
+
+    uint32_t _shard_count = 0;
+
+    uint32_t _shard_cache_count = 0;
+
+    concurrent_lru_cache_mode _mode = concurrent_lru_cache_mode::normal;
+
+    H _hasher;
+private:
+    concurrent_lru_cache(const concurrent_lru_cache&);
+
+    concurrent_lru_cache& operator=(const concurrent_lru_cache&);
+};
+
+/// reclaims expired entries of a cache from a background thread, every interval it
+/// calls cache.expire(batch_count), so memory drops without a 'query' touching the
+/// expired keys and no lock is held for more than one bounded batch
+template<class Cache>
+class lru_cache_sweeper
+{
+public:
+    lru_cache_sweeper(Cache& cache, std::chrono::milliseconds interval, uint32_t batch_count = 256) :
+        _cache(cache),
+        _interval(interval),
+        _batch_count(batch_count),
+        _stopped(false)
+    {
+        _thread = std::thread([this] { run(); });
+    }
+
+    ~lru_cache_sweeper()
+    {
+        {
+            std::lock_guard<std::mutex> lock{ _mutex };
+            _stopped = true;
+        }
+        _cond.notify_all();
+        _thread.join();
+    }
+private:
+    void run()
+    {
+        std::unique_lock<std::mutex> lock{ _mutex };
+        while (!_stopped) {
+            lock.unlock();
+            while (!_stopped && _cache.expire(_batch_count) != 0) {
+                std::this_thread::yield();
+            }
+            lock.lock();
+
+            _cond.wait_for(lock, _interval, [this] { return _stopped.load(); });
+        }
+    }
+
+    Cache& _cache;
+
+    std::chrono::milliseconds _interval;
+
+    uint32_t _batch_count;
+
+    std::atomic<bool> _stopped;
+
+    std::mutex _mutex;
+
+    std::condition_variable _cond;
+
+    std::thread _thread;
+private:
+    lru_cache_sweeper(const lru_cache_sweeper&);
+
+    lru_cache_sweeper& operator=(const lru_cache_sweeper&);
+};
@@ -1,216 +1,699 @@
+#pragma once
 #include <coroutine>
 #include <functional>
-#include <iostream>
-#include <mutex>
+#include <atomic>
+#include <memory>
+#include <new>
+#include <tuple>
+#include <utility>
+#include <optional>
 #include <future>
+#include <vector>
+#ifdef CORO_TRACE
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#endif
 
 namespace co {
-namespace internal {
 
-template<class T>
-struct _task_awaiter_state_base {
-    std::mutex _mutex;
+enum class trace_event : uint8_t {
+    create,
+    resume,
+    suspend,
+    destroy,
+};
 
-    bool _has_val = false;
+struct trace_record {
+    /// steady_clock nanoseconds
+    uint64_t _time;
 
-    std::coroutine_handle<> _handle;
+    /// the task's frame address, the same for all events of one task
+    const void* _frame;
 
-    std::exception_ptr _exc;
+    /// 1 for the first thread recording, 2 for the next...
+    uint32_t _thread;
 
-    bool is_ready() {
-        std::lock_guard<std::mutex> lock{ _mutex };
-        return _has_val || _exc;
+    trace_event _event;
+};
+
+#ifndef CORO_TRACE_CAPACITY
+#define CORO_TRACE_CAPACITY 8192
+#endif
+
+#ifdef CORO_TRACE
+
+/// records task create, resume, suspend and destroy events into a ring of the
+/// last CORO_TRACE_CAPACITY events per thread, no lock on the recording side. a
+/// task is suspended between create and its first resume and at each co_await
+/// that suspends, so resume to suspend is time running, suspend to resume is
+/// time waiting. a thread's ring is reused by the next thread once it exits.
+class task_tracer {
+    enum : uint64_t {
+        capacity = CORO_TRACE_CAPACITY,
+    };
+
+    static_assert((capacity & (capacity - 1)) == 0, "CORO_TRACE_CAPACITY must be a power of 2");
+
+    struct slot {
+        std::atomic<uint64_t> _time;
+
+        std::atomic<const void*> _frame;
+
+        std::atomic<trace_event> _event;
+    };
+
+    /// written by its thread only. '_started' goes up before a slot is written
+    /// and '_done' after, a collector throws away what was overwritten meanwhile
+    struct ring {
+        std::atomic<uint64_t> _started{ 0 };
+
+        std::atomic<uint64_t> _done{ 0 };
+
+        uint32_t _thread = 0;
+
+        slot _slots[capacity];
+    };
+
+    struct detacher {
+        ~detacher() {
+            std::lock_guard<std::mutex> lock{ _mutex };
+            _free_rings.push_back(_local);
+            _local = nullptr;
+            _detached = true;
+        }
+    };
+
+public:
+    static void record(const void* frame, trace_event event) {
+        ring* r = _local;
+        if (!r) {
+            if (_detached) {
+                return;
+            }
+            r = attach();
+        }
+
+        uint64_t index = r->_done.load(std::memory_order_relaxed);
+        r->_started.store(index + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        auto& s = r->_slots[index & (capacity - 1)];
+        s._time.store(now(), std::memory_order_relaxed);
+        s._frame.store(frame, std::memory_order_relaxed);
+        s._event.store(event, std::memory_order_relaxed);
+        r->_done.store(index + 1, std::memory_order_release);
     }
 
-    bool set_handle(std::coroutine_handle<> handle) {
+    /// what the rings hold, by time. safe while tasks run, events recorded
+    /// meanwhile may be missing
+    static std::vector<trace_record> collect() {
+        std::vector<trace_record> records;
+
         std::lock_guard<std::mutex> lock{ _mutex };
-        _handle = handle;
-        return !_has_val && !_exc;
+        for (auto& r : _rings) {
+            uint64_t done = r->_done.load(std::memory_order_acquire);
+            uint64_t first = done > capacity ? done - capacity : 0;
+            size_t begin = records.size();
+            for (uint64_t index = first; index < done; index++) {
+                auto& s = r->_slots[index & (capacity - 1)];
+                records.push_back({ s._time.load(std::memory_order_relaxed), s._frame.load(std::memory_order_relaxed),
+                    r->_thread, s._event.load(std::memory_order_relaxed) });
+            }
+
+            std::atomic_thread_fence(std::memory_order_acquire);
+            uint64_t started = r->_started.load(std::memory_order_relaxed);
+            if (started > first + capacity) {
+                uint64_t overwritten = std::min(started - capacity - first, done - first);
+                records.erase(records.begin() + begin, records.begin() + begin + ptrdiff_t(overwritten));
+            }
+        }
+
+        std::stable_sort(records.begin(), records.end(), [](const trace_record& a, const trace_record& b) {
+            return a._time < b._time;
+        });
+        return records;
     }
 
-    void set_exception(std::exception_ptr exc) {
-        std::lock_guard<std::mutex> lock{ _mutex };
-        _exc = exc;
+    /// one "time thread frame event" line per record, to any std::ostream like stream
+    template<class Stream>
+    static void dump(Stream& os) {
+        static const char* const names[] = { "create", "resume", "suspend", "destroy" };
+        for (auto& record : collect()) {
+            os << record._time << ' ' << record._thread << ' ' << record._frame << ' '
+                << names[size_t(record._event)] << '\n';
+        }
+    }
 
-        if (_handle) {
-            _handle.resume();
+private:
+    static uint64_t now() {
+        return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+    }
+
+    static ring* attach() {
+        {
+            std::lock_guard<std::mutex> lock{ _mutex };
+            if (!_free_rings.empty()) {
+                _local = _free_rings.back();
+                _free_rings.pop_back();
+            } else {
+                _rings.emplace_back(new ring);
+                _local = _rings.back().get();
+                _local->_thread = uint32_t(_rings.size());
+            }
+        }
+
+        static thread_local detacher detach_at_exit;
+        return _local;
+    }
+
+    static inline std::mutex _mutex;
+
+    static inline std::vector<std::unique_ptr<ring>> _rings;
+
+    static inline std::vector<ring*> _free_rings;
+
+    static inline thread_local ring* _local = nullptr;
+
+    static inline thread_local bool _detached = false;
+};
+
+#else
+
+/// tracing disabled, every call inlines to nothing
+class task_tracer {
+public:
+    static void record(const void*, trace_event) {}
+
+    static std::vector<trace_record> collect() {
+        return {};
+    }
+
+    template<class Stream>
+    static void dump(Stream&) {}
+};
+
+#endif
+
+namespace internal {
+
+/// completion handshake between an awaiting coroutine and whoever completes it,
+/// one atomic word: the completer publishes the result and swaps in 'ready', the
+/// awaiting side swaps 'empty' for 'suspended' after it started the work. who
+/// comes second knows: the completer resumes the handle (outside of any lock),
+/// or the awaiting side doesn't suspend at all. nothing is touched after the
+/// swap that lets the other side go on, the state may be gone by then.
+enum : uint32_t {
+    _state_empty,
+    _state_suspended,
+    _state_ready,
+};
+
+struct _task_awaiter_state_base {
+    std::atomic<uint32_t> _state{ _state_empty };
+
+    std::coroutine_handle<> _handle;
+
+    /// set by 'via', the handle is posted to the executor instead of resumed inline
+    void (*_post)(void* executor, std::coroutine_handle<> handle) = nullptr;
+
+    void* _executor = nullptr;
+
+    template<class Executor>
+    void set_executor(Executor& executor) {
+        _executor = &executor;
+        _post = [](void* executor, std::coroutine_handle<> handle) {
+            static_cast<Executor*>(executor)->post(handle);
+        };
+    }
+
+    /// after the work started, false when it completed meanwhile
+    bool suspend() {
+        uint32_t expected = _state_empty;
+        return _state.compare_exchange_strong(expected, _state_suspended,
+            std::memory_order_acq_rel, std::memory_order_acquire);
+    }
+
+    void complete() {
+        std::coroutine_handle<> handle = _handle;
+        auto post = _post;
+        void* executor = _executor;
+        if (_state.exchange(_state_ready, std::memory_order_acq_rel) == _state_suspended) {
+            if (post) {
+                post(executor, handle);
+            } else {
+                handle.resume();
+            }
         }
     }
 };
 
 template<class T>
-struct task_awaiter_state : public _task_awaiter_state_base<T> {
+struct task_awaiter_state : public _task_awaiter_state_base {
     T _val;
 
     void set_value(T val) {
-        std::lock_guard<std::mutex> lock{ this->_mutex };
         this->_val = std::move(val);
-        this->_has_val = true;
-
-        if (this->_handle) {
-            this->_handle.resume();
-        }
+        this->complete();
     }
 
     T get_value() {
-        if (this->_exc) {
-            std::rethrow_exception(this->_exc);
-        }
         return std::move(this->_val);
     }
 };
 
+/// the callback handed to an async function, call it exactly once
 template<class T>
-struct task_awaiter_state<T&> : public _task_awaiter_state_base<T&> {
-    T* _val;
+struct task_awaiter {
+    template<class... Args>
+    void operator()(Args&&... args) const {
+        return _state->set_value(std::make_tuple(args...));
+    }
 
-    void set_value(T& val) {
-        std::lock_guard<std::mutex> lock{ this->_mutex };
-        this->_val = &val;
-        this->_has_val = true;
+    task_awaiter_state<T>* _state;
+};
 
-        if (this->_handle) {
-            this->_handle.resume();
-        }
+/// co_await of an async function taking a callback. nothing runs before the
+/// co_await, the function is called from await_suspend with a callback pointing
+/// at the state, which lives in this awaiter, in the awaiting coroutine's frame,
+/// so there is no allocation. the arguments are kept by value until then.
+template<class T, class Func, class... Args>
+struct async_awaiter {
+    async_awaiter(Func func, Args... args) :
+        _func(std::move(func)),
+        _args(std::move(args)...) {
     }
 
-    T& get_value() {
-        if (this->_exc) {
-            std::rethrow_exception(this->_exc);
-        }
-        return *this->_val;
+    /// only before it is awaited
+    async_awaiter(async_awaiter&& other) :
+        _func(std::move(other._func)),
+        _args(std::move(other._args)) {
+        _state._post = other._state._post;
+        _state._executor = other._state._executor;
+    }
+
+    async_awaiter& operator=(const async_awaiter&) = delete;
+
+    /// resume on executor when completed by another thread, see coro_executor.h
+    template<class Executor>
+    async_awaiter via(Executor& executor) && {
+        _state.set_executor(executor);
+        return std::move(*this);
+    }
+
+    bool await_ready() {
+        return false;
     }
+
+    bool await_suspend(std::coroutine_handle<> handle) {
+        _state._handle = handle;
+        std::apply([&](Args&... args) {
+            std::invoke(_func, args..., task_awaiter<T>{ &_state });
+        }, _args);
+        return _state.suspend();
+    }
+
+    T await_resume() {
+        return _state.get_value();
+    }
+
+    Func _func;
+
+    std::tuple<Args...> _args;
+
+    task_awaiter_state<T> _state;
 };
 
-template<>
-struct task_awaiter_state<void> : public _task_awaiter_state_base<void> {
-    void set_value() {
-        std::lock_guard<std::mutex> lock{ this->_mutex };
-        this->_has_val = true;
+/// where a finished task's result waits for its awaiter, a reference result is kept as a pointer
+template<class T>
+struct _task_result {
+    std::optional<T> _val;
 
-        if (this->_handle) {
-            this->_handle.resume();
-        }
+    template<class V>
+    void set(V&& val) {
+        _val.emplace(std::forward<V>(val));
     }
 
-    void get_value() {
-        if (this->_exc) {
-            std::rethrow_exception(this->_exc);
-        }
+    T get() {
+        return std::move(*_val);
     }
 };
 
 template<class T>
-struct _task_awaiter_base {
-    _task_awaiter_base() {
-        _state = std::make_shared<task_awaiter_state<T>>();
+struct _task_result<T&> {
+    T* _val = nullptr;
+
+    void set(T& val) {
+        _val = &val;
     }
 
-    auto get_state() {
-        return _state;
+    T& get() {
+        return *_val;
     }
+};
 
+#ifdef CORO_TRACE
+
+/// the awaiter co_await uses for value
+template<class U>
+decltype(auto) _get_awaiter(U&& value) {
+    if constexpr (requires { std::forward<U>(value).operator co_await(); }) {
+        return std::forward<U>(value).operator co_await();
+    } else if constexpr (requires { operator co_await(std::forward<U>(value)); }) {
+        return operator co_await(std::forward<U>(value));
+    } else {
+        return std::forward<U>(value);
+    }
+}
+
+/// wraps every co_await in a task to record its suspend and resume. the suspend
+/// is recorded before the inner await_suspend, the task may be running on
+/// another thread or be gone as soon as that is called.
+template<class Awaiter>
+struct _traced_awaiter {
     bool await_ready() {
-        return _state->is_ready();
+        return _awaiter.await_ready();
     }
 
-    auto await_resume() {
-        return _state->get_value();
+    template<class Promise>
+    decltype(auto) await_suspend(std::coroutine_handle<Promise> handle) {
+        _frame = handle.address();
+        task_tracer::record(_frame, trace_event::suspend);
+        return _awaiter.await_suspend(handle);
     }
 
-    bool await_suspend(std::coroutine_handle<> handle) {
-        return _state->set_handle(handle);
+    decltype(auto) await_resume() {
+        if (_frame) {
+            task_tracer::record(_frame, trace_event::resume);
+        }
+        return _awaiter.await_resume();
     }
 
-    std::shared_ptr<task_awaiter_state<T>> _state;
+    /// a reference when co_await was given the awaiter itself, it lives as long
+    Awaiter _awaiter;
+
+    /// set once suspended, an awaiter that was ready records nothing
+    const void* _frame = nullptr;
 };
 
-template<class T>
-struct task_awaiter : public _task_awaiter_base<T> {
-    template<class... Args>
-    void operator()(Args&&... args) {
-        return this->_state->set_value(std::make_tuple(args...));
+#endif
+
+/// final_suspend of a task. an awaited task transfers straight to its awaiting
+/// coroutine (symmetric transfer, a tail call, so await chains of any depth run
+/// in constant stack) or posts it to the executor given by 'via'. the frame is
+/// destroyed by the co::task owning it, a task started by run_coro has none and
+/// destroys itself.
+struct _task_final_awaiter {
+    bool await_ready() noexcept {
+        return false;
+    }
+
+    template<class Promise>
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept {
+        task_tracer::record(handle.address(), trace_event::suspend);
+
+        auto& promise = handle.promise();
+        if (promise._promise) {
+            handle.destroy();
+            return std::noop_coroutine();
+        }
+
+        std::coroutine_handle<> continuation = promise._continuation;
+        if (!continuation) {
+            return std::noop_coroutine();
+        }
+
+        if (promise._post) {
+            /// the awaiting side may destroy this frame as soon as it runs
+            promise._post(promise._executor, continuation);
+            return std::noop_coroutine();
+        }
+
+        return continuation;
+    }
+
+    void await_resume() noexcept {
     }
 };
 
-template<>
-struct task_awaiter<void> : public _task_awaiter_base<void> {
-    void operator()() {
-        return this->_state->set_value();
+/// in front of every task frame, says how to give the frame back
+struct alignas(__STDCPP_DEFAULT_NEW_ALIGNMENT__) _frame_header {
+    void (*_deallocate)(_frame_header* header, size_t size);
+};
+
+/// per-thread free lists of task frames by size class. a frame freed on another
+/// thread (e.g. finished on an executor) goes to that thread's lists, each list
+/// keeps at most max_cached frames, larger frames go to operator new directly.
+/// what is cached is released when the thread exits.
+class _frame_pool {
+    enum : size_t {
+        granularity = 64,
+        class_count = 16,
+        max_cached = 256,
+    };
+
+    struct node {
+        node* _next;
+    };
+
+    /// trivial, so it stays usable while other thread_locals are destroyed
+    struct pool_state {
+        node* _heads[class_count];
+
+        uint32_t _counts[class_count];
+
+        bool _registered;
+
+        bool _closed;
+    };
+
+    struct releaser {
+        ~releaser() {
+            for (size_t index = 0; index < class_count; index++) {
+                while (node* n = _state._heads[index]) {
+                    _state._heads[index] = n->_next;
+                    ::operator delete(n);
+                }
+                _state._counts[index] = 0;
+            }
+            _state._closed = true;
+        }
+    };
+
+public:
+    static void* allocate(size_t size) {
+        size_t index = size_class(size);
+        void* block;
+        if (index < class_count && _state._heads[index]) {
+            node* n = _state._heads[index];
+            _state._heads[index] = n->_next;
+            _state._counts[index]--;
+            block = n;
+        } else {
+            block = ::operator new(index < class_count ? (index + 1) * granularity : sizeof(_frame_header) + size);
+        }
+
+        auto header = ::new (block) _frame_header{ &deallocate };
+        return header + 1;
+    }
+
+private:
+    static void deallocate(_frame_header* header, size_t size) {
+        size_t index = size_class(size);
+        if (index >= class_count || _state._closed || _state._counts[index] >= max_cached) {
+            ::operator delete(header);
+            return;
+        }
+
+        if (!_state._registered) {
+            _state._registered = true;
+            static thread_local releaser release_at_exit;
+        }
+
+        node* n = ::new (static_cast<void*>(header)) node{ _state._heads[index] };
+        _state._heads[index] = n;
+        _state._counts[index]++;
+    }
+
+    static size_t size_class(size_t size) {
+        return (sizeof(_frame_header) + size - 1) / granularity;
+    }
+
+    static inline thread_local pool_state _state{};
+};
+
+/// task frames from a caller's allocator, see task. the allocator is copied
+/// behind the frame, so freeing needs nothing but the frame size.
+template<class Alloc>
+struct _frame_allocator {
+    typedef typename std::allocator_traits<Alloc>::template rebind_alloc<_frame_header> unit_allocator;
+
+    typedef std::allocator_traits<unit_allocator> traits;
+
+    static void* allocate(const Alloc& alloc, size_t size) {
+        unit_allocator a(alloc);
+        _frame_header* header = traits::allocate(a, units(size));
+        ::new (static_cast<void*>(header)) _frame_header{ &deallocate };
+        ::new (static_cast<void*>(reinterpret_cast<char*>(header) + offset(size))) unit_allocator(std::move(a));
+        return header + 1;
+    }
+
+    static void deallocate(_frame_header* header, size_t size) {
+        auto stored = reinterpret_cast<unit_allocator*>(reinterpret_cast<char*>(header) + offset(size));
+        unit_allocator a(std::move(*stored));
+        stored->~unit_allocator();
+        traits::deallocate(a, header, units(size));
+    }
+
+    /// where the allocator copy goes
+    static size_t offset(size_t size) {
+        return (sizeof(_frame_header) + size + alignof(unit_allocator) - 1) & ~(alignof(unit_allocator) - 1);
+    }
+
+    static size_t units(size_t size) {
+        return (offset(size) + sizeof(unit_allocator) + sizeof(_frame_header) - 1) / sizeof(_frame_header);
     }
 };
 
 template<class T>
 struct _task_promise_base {
+    static void* operator new(size_t size) {
+        return _frame_pool::allocate(size);
+    }
+
+    template<class Alloc, class... Args>
+    static void* operator new(size_t size, std::allocator_arg_t, const Alloc& alloc, const Args&...) {
+        return _frame_allocator<Alloc>::allocate(alloc, size);
+    }
+
+    /// member functions and lambdas, the object comes first
+    template<class This, class Alloc, class... Args>
+    static void* operator new(size_t size, const This&, std::allocator_arg_t, const Alloc& alloc, const Args&...) {
+        return _frame_allocator<Alloc>::allocate(alloc, size);
+    }
+
+    static void operator delete(void* ptr, size_t size) {
+        auto header = static_cast<_frame_header*>(ptr) - 1;
+        header->_deallocate(header, size);
+    }
+
+#ifdef CORO_TRACE
+    _traced_awaiter<std::suspend_always> initial_suspend() {
+        return {};
+    }
+
+    template<class U>
+    auto await_transform(U&& value) -> _traced_awaiter<decltype(_get_awaiter(std::forward<U>(value)))> {
+        return { _get_awaiter(std::forward<U>(value)) };
+    }
+#else
     std::suspend_always initial_suspend() {
         return {};
     }
+#endif
 
-    std::suspend_never final_suspend() noexcept {
+    _task_final_awaiter final_suspend() noexcept {
         return {};
     }
 
     void unhandled_exception() {
-        if (_awaiter) {
-            _awaiter->set_exception(std::current_exception());
-        }
-        else if (_promise) {
+        if (_promise) {
             _promise->set_exception(std::current_exception());
+        } else {
+            _exc = std::current_exception();
         }
     }
 
-    void use_awaiter(std::shared_ptr<task_awaiter_state<T>> p) {
-        _awaiter = p;
-    }
-
     void use_promise() {
         _promise = std::make_shared<std::promise<T>>();
     }
 
-    std::shared_ptr<task_awaiter_state<T>> _awaiter;
+    template<class Executor>
+    void set_executor(Executor& executor) {
+        _executor = &executor;
+        _post = [](void* executor, std::coroutine_handle<> handle) {
+            static_cast<Executor*>(executor)->post(handle);
+        };
+    }
+
+    void rethrow_if_failed() {
+        if (_exc) {
+            std::rethrow_exception(_exc);
+        }
+    }
+
+    /// the coroutine awaiting this task
+    std::coroutine_handle<> _continuation;
+
+    std::exception_ptr _exc;
 
+    void (*_post)(void* executor, std::coroutine_handle<> handle) = nullptr;
+
+    void* _executor = nullptr;
+
+    /// set by run_coro, nobody awaits the task
     std::shared_ptr<std::promise<T>> _promise;
 };
 
 template<class T>
 struct _task_promise : public _task_promise_base<T> {
     void return_value(T value) {
-        if (this->_awaiter) {
-            this->_awaiter->set_value(std::move(value));
-        }
-        else if (this->_promise) {
-            this->_promise->set_value(std::move(value));
+        if (this->_promise) {
+            this->_promise->set_value(std::forward<T>(value));
+        } else {
+            _result.set(std::forward<T>(value));
         }
     }
+
+    T get_value() {
+        this->rethrow_if_failed();
+        return _result.get();
+    }
+
+    _task_result<T> _result;
 };
 
 template<>
 struct _task_promise<void> : public _task_promise_base<void> {
     void return_void() {
-        if (this->_awaiter) {
-            this->_awaiter->set_value();
-        }
-        else if (this->_promise) {
+        if (this->_promise) {
             this->_promise->set_value();
         }
     }
+
+    void get_value() {
+        this->rethrow_if_failed();
+    }
 };
 
 } // namespace internal
 
+/// co_await a task to run it, the awaiting coroutine is suspended and the task
+/// starts right away on the same thread, when it finishes the awaiting coroutine
+/// continues where the task finished. a task is lazy, it owns its frame and one
+/// that is never awaited is destroyed without running. only an rvalue task can
+/// be awaited.
+///
+/// frames come from a per-thread pool. a coroutine whose first parameters (after
+/// the object, for member functions) are std::allocator_arg_t and an allocator
+/// gets its frame from that allocator, e.g. a std::pmr arena. the frame may be
+/// freed on another thread than it was allocated on, the allocator has to allow it.
 template<class T>
 struct task {
     struct promise_type;
 
+    using value_type = T;
+
     using handle_type = std::coroutine_handle<promise_type>;
 
     struct promise_type : public internal::_task_promise<T> {
         promise_type() {
-            std::cout << "task promise created ==> " << this << std::endl;
+            task_tracer::record(handle_type::from_promise(*this).address(), trace_event::create);
         }
 
         ~promise_type() {
-            std::cout << "task promise destroyed <== " << this << std::endl;
+            task_tracer::record(handle_type::from_promise(*this).address(), trace_event::destroy);
         }
 
         task get_return_object() {
@@ -218,85 +701,107 @@ struct task {
         }
     };
 
-    task(handle_type h) : _handle(h) {
+    struct awaiter {
+        bool await_ready() {
+            return false;
+        }
+
+        /// symmetric transfer into the task
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> handle) {
+            _coro.promise()._continuation = handle;
+            return _coro;
+        }
+
+        decltype(auto) await_resume() {
+            return _coro.promise().get_value();
+        }
+
+        handle_type _coro;
+    };
+
+    explicit task(handle_type h) : _handle(h) {
     }
 
-    ~task() {
+    task(task&& other) noexcept : _handle(std::exchange(other._handle, nullptr)) {
     }
 
-private:
-    template<class Func, class... Args>
-    friend auto call_coro(Func&& func, Args&&... args);
+    task(const task&) = delete;
 
-    template<class Func, class... Args>
-    friend auto run_coro(Func&& func, Args&&... args);
+    task& operator=(const task&) = delete;
 
-    auto& promise() {
-        return _handle.promise();
+    ~task() {
+        if (_handle) {
+            _handle.destroy();
+        }
     }
 
-    void resume() {
-        return _handle.resume();
-    }
+    /// a task runs once, await it as an rvalue (co_await std::move(t)) so a
+    /// second co_await of the same task doesn't compile instead of reading a
+    /// finished frame
+    awaiter operator co_await() & = delete;
 
-    auto future() {
-        return _handle.promise()._promise->get_future();
+    awaiter operator co_await() && {
+        return { _handle };
     }
 
-    handle_type _handle;
-};
+    /// the awaiting coroutine goes on on executor, see coro_executor.h
+    template<class Executor>
+    task via(Executor& executor) && {
+        _handle.promise().set_executor(executor);
+        return std::move(*this);
+    }
 
-template<class Type>
-struct _async_task_runner {
+private:
     template<class Func, class... Args>
-    auto operator()(Func&& func, Args&&... args) const {
-        Type waiter{};
-        std::invoke(std::forward<Func>(func), std::forward<Args>(args)..., waiter);
-        return waiter;
-    }
+    friend auto run_coro(Func&& func, Args&&... args);
+
+    handle_type _handle;
 };
 
 template<class... Args>
 struct _get_async_awaiter_type {
     using tuple_type = decltype(std::make_tuple(std::declval<Args>()...));
-    using type = internal::task_awaiter<tuple_type>;
+
+    template<class Func, class... FuncArgs>
+    using type = internal::async_awaiter<tuple_type, std::decay_t<Func>, std::decay_t<FuncArgs>...>;
 };
 
 template<class... Args>
-constexpr _async_task_runner<typename _get_async_awaiter_type<Args...>::type> run_async;
-
-template<class Func>
-struct _get_task_param_type;
-
-template<class Ret>
-struct _get_task_param_type<task<Ret>> {
-    using type = internal::task_awaiter<Ret>;
+struct _async_task_runner {
+    template<class Func, class... FuncArgs>
+    auto operator()(Func&& func, FuncArgs&&... args) const {
+        using Awaiter = typename _get_async_awaiter_type<Args...>::template type<Func, FuncArgs...>;
+        return Awaiter(std::forward<Func>(func), std::forward<FuncArgs>(args)...);
+    }
 };
 
+template<class... Args>
+constexpr _async_task_runner<Args...> run_async;
+
+/// co_await co::call_async<std::error_code, int>(func, args...) calls
+/// func(args..., callback) and resumes with std::tuple<std::error_code, int> once
+/// the callback is called with those
+template<class... Args, class Func, class... FuncArgs>
+auto call_async(Func&& func, FuncArgs&&... args) {
+    return run_async<Args...>(std::forward<Func>(func), std::forward<FuncArgs>(args)...);
+}
+
+/// co_await co::call_coro(func, args...) is co_await of the task func returns
 template<class Func, class... Args>
 auto call_coro(Func&& func, Args&&... args) {
-    using TaskType = decltype(
-        std::invoke(std::forward<Func>(func), std::forward<Args>(args)...)
-    );
-
-    using Awaiter = _get_task_param_type<TaskType>::type;
-
-    Awaiter waiter{};
-    auto t = std::invoke(std::forward<Func>(func), std::forward<Args>(args)...);
-    t.promise().use_awaiter(waiter.get_state());
-    t.resume();
-
-    return waiter;
+    return std::invoke(std::forward<Func>(func), std::forward<Args>(args)...);
 }
 
 template<class Func, class... Args>
 auto run_coro(Func&& func, Args&&... args) {
     auto t = std::invoke(std::forward<Func>(func), std::forward<Args>(args)...);
-    t.promise().use_promise();
 
-    auto f = t.future();
-    t.resume();
+    auto& promise = t._handle.promise();
+    promise.use_promise();
+    auto f = promise._promise->get_future();
 
+    /// the frame destroys itself when done
+    std::exchange(t._handle, nullptr).resume();
     return f;
 }
 
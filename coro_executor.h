@@ -0,0 +1,247 @@
+#pragma once
+#include "coro.h"
+#include <atomic>
+#include <concepts>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace co {
+
+/// anything that can run a coroutine handle later, on one of its threads
+template<class E>
+concept executor = requires(E& e, std::coroutine_handle<> handle) {
+    e.post(handle);
+};
+
+namespace internal {
+
+template<class E>
+struct schedule_awaiter {
+    bool await_ready() {
+        return false;
+    }
+
+    void await_suspend(std::coroutine_handle<> handle) {
+        _executor.post(handle);
+    }
+
+    void await_resume() {
+    }
+
+    E& _executor;
+};
+
+} // namespace internal
+
+/// co_await co::schedule_on(pool) moves the rest of the coroutine onto pool
+template<executor E>
+internal::schedule_awaiter<E> schedule_on(E& e) {
+    return { e };
+}
+
+/// fixed set of threads, each with its own queue. a handle posted from a pool
+/// thread goes to that thread's queue and is taken newest first by it (its frame
+/// is still in cache), idle threads steal the oldest handle of another queue,
+/// handles posted from outside are spread round robin. idle threads sleep on an
+/// atomic wait. the destructor runs what is queued and joins the threads.
+class thread_pool_executor {
+    struct worker {
+        std::mutex _mutex;
+
+        std::deque<std::coroutine_handle<>> _queue;
+
+        std::thread _thread;
+    };
+public:
+    explicit thread_pool_executor(uint32_t thread_count = std::thread::hardware_concurrency()) :
+        _next(0),
+        _signal(0),
+        _stopped(false) {
+        if (thread_count == 0) {
+            thread_count = 1;
+        }
+
+        for (uint32_t i = 0; i < thread_count; i++) {
+            _workers.emplace_back(new worker);
+        }
+        for (uint32_t i = 0; i < thread_count; i++) {
+            _workers[i]->_thread = std::thread([this, i] { run(i); });
+        }
+    }
+
+    thread_pool_executor(const thread_pool_executor&) = delete;
+
+    thread_pool_executor& operator=(const thread_pool_executor&) = delete;
+
+    ~thread_pool_executor() {
+        _stopped = true;
+        _signal.fetch_add(1, std::memory_order_release);
+        _signal.notify_all();
+
+        for (auto& w : _workers) {
+            w->_thread.join();
+        }
+    }
+
+    void post(std::coroutine_handle<> handle) {
+        uint32_t index = _current == this
+            ? _current_index
+            : _next.fetch_add(1, std::memory_order_relaxed) % uint32_t(_workers.size());
+
+        {
+            auto& w = *_workers[index];
+            std::lock_guard<std::mutex> lock{ w._mutex };
+            w._queue.push_back(handle);
+        }
+
+        _signal.fetch_add(1, std::memory_order_release);
+        _signal.notify_one();
+    }
+
+    bool running_in_this_thread() const {
+        return _current == this;
+    }
+
+    uint32_t thread_count() const {
+        return uint32_t(_workers.size());
+    }
+
+private:
+    void run(uint32_t index) {
+        _current = this;
+        _current_index = index;
+
+        for (;;) {
+            uint32_t signal = _signal.load(std::memory_order_acquire);
+
+            std::coroutine_handle<> handle;
+            if (pop(index, handle) || steal(index, handle)) {
+                handle.resume();
+                continue;
+            }
+
+            if (_stopped) {
+                break;
+            }
+
+            _signal.wait(signal, std::memory_order_acquire);
+        }
+
+        _current = nullptr;
+    }
+
+    bool pop(uint32_t index, std::coroutine_handle<>& handle) {
+        auto& w = *_workers[index];
+        std::lock_guard<std::mutex> lock{ w._mutex };
+        if (w._queue.empty()) {
+            return false;
+        }
+
+        handle = w._queue.back();
+        w._queue.pop_back();
+        return true;
+    }
+
+    bool steal(uint32_t index, std::coroutine_handle<>& handle) {
+        for (uint32_t i = 1; i < _workers.size(); i++) {
+            auto& w = *_workers[(index + i) % _workers.size()];
+            std::unique_lock<std::mutex> lock{ w._mutex, std::try_to_lock };
+            if (!lock.owns_lock() || w._queue.empty()) {
+                continue;
+            }
+
+            handle = w._queue.front();
+            w._queue.pop_front();
+            return true;
+        }
+        return false;
+    }
+
+    std::vector<std::unique_ptr<worker>> _workers;
+
+    std::atomic<uint32_t> _next;
+
+    std::atomic<uint32_t> _signal;
+
+    std::atomic<bool> _stopped;
+
+    static inline thread_local thread_pool_executor* _current = nullptr;
+
+    static inline thread_local uint32_t _current_index = 0;
+};
+
+/// runs posted handles on the thread calling 'run', in post order, e.g. the ui
+/// thread. 'run' returns after 'stop', 'poll' runs what is queued and returns.
+class run_loop_executor {
+public:
+    run_loop_executor() :
+        _stopped(false) {
+    }
+
+    run_loop_executor(const run_loop_executor&) = delete;
+
+    run_loop_executor& operator=(const run_loop_executor&) = delete;
+
+    /// notifies under the lock, the loop may be gone right after it ran the handle
+    void post(std::coroutine_handle<> handle) {
+        std::lock_guard<std::mutex> lock{ _mutex };
+        _queue.push_back(handle);
+        _cond.notify_one();
+    }
+
+    void run() {
+        std::unique_lock<std::mutex> lock{ _mutex };
+        for (;;) {
+            _cond.wait(lock, [this] { return _stopped || !_queue.empty(); });
+            if (_queue.empty()) {
+                break;
+            }
+
+            run_queued(lock);
+        }
+        _stopped = false;
+    }
+
+    /// returns how many handles ran
+    size_t poll() {
+        std::unique_lock<std::mutex> lock{ _mutex };
+        return run_queued(lock);
+    }
+
+    /// 'run' returns once the queue is empty
+    void stop() {
+        std::lock_guard<std::mutex> lock{ _mutex };
+        _stopped = true;
+        _cond.notify_all();
+    }
+
+private:
+    /// takes the whole queue at once, handles posted meanwhile run in the next round.
+    /// the batch is local, a handle may poll() again while it runs
+    size_t run_queued(std::unique_lock<std::mutex>& lock) {
+        std::vector<std::coroutine_handle<>> running;
+        running.swap(_queue);
+        lock.unlock();
+
+        for (auto handle : running) {
+            handle.resume();
+        }
+
+        lock.lock();
+        return running.size();
+    }
+
+    std::mutex _mutex;
+
+    std::condition_variable _cond;
+
+    std::vector<std::coroutine_handle<>> _queue;
+
+    bool _stopped;
+};
+
+}
@@ -0,0 +1,207 @@
+#pragma once
+#include "event_stream.h"
+#include "flat_hash_index.h"
+#include <memory>
+#include <stdexcept>
+
+template<class K, class T, class H = std::hash<K>>
+class event_bus
+{
+};
+
+/// event_streams by key. 'emit(key, ...)' finds the key's stream in a flat open
+/// addressing index and runs only its handlers, plus the wildcard handlers
+/// subscribed with 'subscribe_all', so the cost of an emit doesn't depend on how
+/// many handlers listen to other keys.
+///
+/// each key's stream is an event_stream, handlers are called in subscription
+/// order and may emit, subscribe and unsubscribe. a key whose last handler
+/// unsubscribes is dropped from the index, its stream is kept for the next key.
+///
+/// a guid is the key's slot index + 1 in bits 32..51 and the slot's generation in
+/// bits 52..63 above the guid of the key's stream, wildcard guids have 0 there.
+template<class K, class... A, class H>
+class event_bus<K, void(A...), H>
+{
+    typedef event_stream<void(typename event_param<A>::type...)> stream_type;
+
+    typedef event_stream<void(const K&, typename event_param<A>::type...)> wildcard_stream_type;
+
+    enum : uint32_t
+    {
+        npos = flat_hash_index::npos,
+        slot_bits = 20,
+        slot_mask = (1u << slot_bits) - 1,
+        generation_mask = 0xfff,
+    };
+
+    struct event_topic
+    {
+        K _key;
+
+        size_t _hash;
+
+        uint32_t _generation;
+
+        bool _linked;
+
+        /// streams don't move, handlers may run while _topics grows
+        std::unique_ptr<stream_type> _stream;
+    };
+public:
+    typedef typename stream_type::func_type func_type;
+
+    typedef typename wildcard_stream_type::func_type wildcard_func_type;
+
+    event_bus(H hasher = H()) :
+        _hasher(hasher),
+        _index(16),
+        _size(0)
+    {
+    }
+
+    uint64_t subscribe(const K& key, func_type t)
+    {
+        if (!t) return 0;
+
+        size_t hash = _hasher(key);
+        uint32_t index = find(key, hash);
+        if (index == npos) {
+            index = create_topic(key, hash);
+        }
+
+        auto& topic = _topics[index];
+        uint64_t inner = topic._stream->subscribe(std::move(t));
+        uint64_t outer = (index + 1) | ((topic._generation & generation_mask) << slot_bits);
+        return (outer << 32) | inner;
+    }
+
+    /// handler for every key, called after the key's own handlers
+    uint64_t subscribe_all(wildcard_func_type t)
+    {
+        return _wildcards.subscribe(std::move(t));
+    }
+
+    void unsubscribe(uint64_t guid)
+    {
+        uint32_t outer = uint32_t(guid >> 32);
+        uint32_t inner = uint32_t(guid);
+        if (outer == 0) {
+            _wildcards.unsubscribe(inner);
+            return;
+        }
+
+        uint32_t index = (outer & slot_mask) - 1;
+        if (index >= _topics.size()) return;
+
+        auto& topic = _topics[index];
+        if (!topic._linked || (topic._generation & generation_mask) != (outer >> slot_bits)) return;
+
+        topic._stream->unsubscribe(inner);
+        if (topic._stream->size() == 0) {
+            remove_topic(index);
+        }
+    }
+
+    void emit(const K& key, A... args)
+    {
+        uint32_t index = find(key, _hasher(key));
+        if (index != npos) {
+            _topics[index]._stream->emit(args...);
+        }
+
+        if (_wildcards.size() != 0) {
+            _wildcards.emit(key, args...);
+        }
+    }
+
+    /// keys having handlers
+    size_t size() const
+    {
+        return _size;
+    }
+private:
+    uint32_t create_topic(const K& key, size_t hash)
+    {
+        uint32_t index;
+        if (!_free_topics.empty()) {
+            index = _free_topics.back();
+            _free_topics.pop_back();
+        } else {
+            if (_topics.size() >= slot_mask)
+                throw std::runtime_error("event_bus, too many keys");
+
+            _topics.push_back(event_topic{ K(), 0, 0, false, std::unique_ptr<stream_type>(new stream_type) });
+            index = uint32_t(_topics.size() - 1);
+        }
+
+        if ((_size + 1) * 2 > _index.bucket_count()) {
+            rehash();
+        }
+
+        auto& topic = _topics[index];
+        topic._key = key;
+        topic._hash = hash;
+        topic._linked = true;
+        link(index);
+        _size++;
+        return index;
+    }
+
+    void remove_topic(uint32_t index)
+    {
+        unlink(index);
+        _size--;
+
+        auto& topic = _topics[index];
+        topic._linked = false;
+        topic._generation++;
+        topic._key = K();
+        _free_topics.push_back(index);
+    }
+
+    uint32_t find(const K& key, size_t hash) const
+    {
+        return _index.find(hash, [&](uint32_t index) {
+            auto& topic = _topics[index];
+            return topic._hash == hash && topic._key == key;
+        });
+    }
+
+    void link(uint32_t index)
+    {
+        _index.link(index, _topics[index]._hash);
+    }
+
+    void unlink(uint32_t index)
+    {
+        _index.unlink(index, _topics[index]._hash, [this](uint32_t other) { return _topics[other]._hash; });
+    }
+
+    /// doubles the buckets, keeping at most half of them used
+    void rehash()
+    {
+        _index.reset(_index.bucket_count() * 2);
+
+        for (uint32_t index = 0; index < _topics.size(); index++) {
+            if (_topics[index]._linked) {
+                link(index);
+            }
+        }
+    }
+
+    H _hasher;
+
+    std::vector<event_topic> _topics;
+
+    std::vector<uint32_t> _free_topics;
+
+    flat_hash_index _index;
+
+    size_t _size;
+
+    wildcard_stream_type _wildcards;
+private:
+    event_bus(const event_bus&);
+    event_bus& operator=(const event_bus&);
+};
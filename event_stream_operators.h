@@ -0,0 +1,413 @@
+#pragma once
+#include "event_stream.h"
+#include <chrono>
+#include <tuple>
+#include <optional>
+#include <initializer_list>
+
+namespace event_stream_internal {
+
+/// how an operator stores one event, the bare value for one parameter, a tuple otherwise
+template<class... A>
+struct event_value
+{
+    typedef std::tuple<typename std::decay<A>::type...> type;
+
+    template<class... P>
+    static void assign(std::optional<type>& slot, const P&... args)
+    {
+        if (slot) {
+            *slot = std::tie(args...);
+        } else {
+            slot.emplace(args...);
+        }
+    }
+
+    template<class Stream>
+    static void emit(Stream& stream, const type& value)
+    {
+        std::apply([&](const auto&... args) { stream.emit(args...); }, value);
+    }
+};
+
+template<class A>
+struct event_value<A>
+{
+    typedef typename std::decay<A>::type type;
+
+    template<class P>
+    static void assign(std::optional<type>& slot, const P& arg)
+    {
+        if (slot) {
+            *slot = arg;
+        } else {
+            slot.emplace(arg);
+        }
+    }
+
+    template<class Stream>
+    static void emit(Stream& stream, const type& value)
+    {
+        stream.emit(value);
+    }
+};
+
+}
+
+/// subscription which unsubscribes when it goes away, the stream must outlive it
+template<class T>
+class event_subscription
+{
+};
+
+template<class... A>
+class event_subscription<void(A...)>
+{
+public:
+    typedef event_stream<void(A...)> stream_type;
+
+    event_subscription() :
+        _stream(nullptr),
+        _guid(0)
+    {
+    }
+
+    event_subscription(stream_type& stream, typename stream_type::func_type handler) :
+        _stream(&stream),
+        _guid(stream.subscribe(std::move(handler)))
+    {
+    }
+
+    event_subscription(event_subscription&& other) noexcept :
+        _stream(other._stream),
+        _guid(other._guid)
+    {
+        other._stream = nullptr;
+        other._guid = 0;
+    }
+
+    ~event_subscription()
+    {
+        if (_stream) {
+            _stream->unsubscribe(_guid);
+        }
+    }
+private:
+    stream_type* _stream;
+
+    uint32_t _guid;
+
+    event_subscription(const event_subscription&);
+    event_subscription& operator=(const event_subscription&);
+};
+
+/// the operators below subscribe to a source event_stream and are event_streams
+/// themselves, so they chain. they unsubscribe when destroyed, the source must
+/// outlive them. time based ones (debounce, sample, timed buffer) don't own a
+/// timer, call 'tick' from the frame loop or whatever drives the thread, with
+/// the Clock's now by default.
+
+template<class T, class Clock = std::chrono::steady_clock>
+class event_throttle
+{
+};
+
+/// forwards an event, then drops everything for 'interval'
+template<class... A, class Clock>
+class event_throttle<void(A...), Clock> : public event_stream<void(A...)>
+{
+public:
+    event_throttle(event_stream<void(A...)>& source, typename Clock::duration interval) :
+        _interval(interval),
+        _has_emitted(false),
+        _subscription(source, [this](typename event_param<A>::type... args) { on_event(args...); })
+    {
+    }
+private:
+    void on_event(typename event_param<A>::type... args)
+    {
+        auto now = Clock::now();
+        if (_has_emitted && now - _last_emit < _interval) return;
+
+        _has_emitted = true;
+        _last_emit = now;
+        this->emit(args...);
+    }
+
+    typename Clock::duration _interval;
+
+    typename Clock::time_point _last_emit;
+
+    bool _has_emitted;
+
+    event_subscription<void(A...)> _subscription;
+};
+
+template<class T, class Clock = std::chrono::steady_clock>
+class event_debounce
+{
+};
+
+/// forwards the latest event once the source has been quiet for 'interval'
+template<class... A, class Clock>
+class event_debounce<void(A...), Clock> : public event_stream<void(A...)>
+{
+    typedef event_stream_internal::event_value<A...> value_traits;
+public:
+    event_debounce(event_stream<void(A...)>& source, typename Clock::duration interval) :
+        _interval(interval),
+        _has_pending(false),
+        _subscription(source, [this](typename event_param<A>::type... args) {
+            value_traits::assign(_pending, args...);
+            _has_pending = true;
+            _last_event = Clock::now();
+        })
+    {
+    }
+
+    void tick(typename Clock::time_point now = Clock::now())
+    {
+        if (_has_pending && now - _last_event >= _interval) {
+            _has_pending = false;
+            value_traits::emit(*this, *_pending);
+        }
+    }
+private:
+    typename Clock::duration _interval;
+
+    typename Clock::time_point _last_event;
+
+    /// kept after emitting, the next event is assigned into it
+    std::optional<typename value_traits::type> _pending;
+
+    bool _has_pending;
+
+    event_subscription<void(A...)> _subscription;
+};
+
+template<class T, class Clock = std::chrono::steady_clock>
+class event_sample
+{
+};
+
+/// forwards the latest event at most once per 'period', nothing when there was none
+template<class... A, class Clock>
+class event_sample<void(A...), Clock> : public event_stream<void(A...)>
+{
+    typedef event_stream_internal::event_value<A...> value_traits;
+public:
+    event_sample(event_stream<void(A...)>& source, typename Clock::duration period) :
+        _period(period),
+        _next_sample(Clock::now() + period),
+        _has_pending(false),
+        _subscription(source, [this](typename event_param<A>::type... args) {
+            value_traits::assign(_pending, args...);
+            _has_pending = true;
+        })
+    {
+    }
+
+    void tick(typename Clock::time_point now = Clock::now())
+    {
+        if (now < _next_sample) return;
+
+        _next_sample = now + _period;
+        if (_has_pending) {
+            _has_pending = false;
+            value_traits::emit(*this, *_pending);
+        }
+    }
+private:
+    typename Clock::duration _period;
+
+    typename Clock::time_point _next_sample;
+
+    std::optional<typename value_traits::type> _pending;
+
+    bool _has_pending;
+
+    event_subscription<void(A...)> _subscription;
+};
+
+template<class T, class Clock = std::chrono::steady_clock>
+class event_buffer
+{
+};
+
+/// collects events and forwards them as one vector, when 'count' are collected
+/// or, with a window, when the oldest one is 'window' old at a tick. the vector
+/// is cleared after each batch and keeps its capacity, so a steady stream
+/// doesn't allocate. events of several parameters are collected as tuples.
+template<class... A, class Clock>
+class event_buffer<void(A...), Clock>
+    : public event_stream<void(const std::vector<typename event_stream_internal::event_value<A...>::type>&)>
+{
+    typedef event_stream_internal::event_value<A...> value_traits;
+public:
+    typedef typename value_traits::type value_type;
+
+    /// 'count' 0 means only the window flushes
+    event_buffer(event_stream<void(A...)>& source, size_t count,
+        typename Clock::duration window = typename Clock::duration::zero()) :
+        _count(count),
+        _window(window),
+        _subscription(source, [this](typename event_param<A>::type... args) { on_event(args...); })
+    {
+        if (_count != 0) {
+            _buffer.reserve(_count);
+        }
+    }
+
+    event_buffer(event_stream<void(A...)>& source, typename Clock::duration window) :
+        event_buffer(source, 0, window)
+    {
+    }
+
+    void tick(typename Clock::time_point now = Clock::now())
+    {
+        if (!_buffer.empty() && _window != Clock::duration::zero() && now - _first_event >= _window) {
+            flush();
+        }
+    }
+
+    /// forwards what is collected so far
+    void flush()
+    {
+        if (_buffer.empty()) return;
+
+        this->emit(_buffer);
+        _buffer.clear();
+    }
+private:
+    void on_event(typename event_param<A>::type... args)
+    {
+        if (_buffer.empty()) {
+            _first_event = Clock::now();
+        }
+
+        _buffer.emplace_back(args...);
+        if (_buffer.size() == _count) {
+            flush();
+        }
+    }
+
+    size_t _count;
+
+    typename Clock::duration _window;
+
+    typename Clock::time_point _first_event;
+
+    std::vector<value_type> _buffer;
+
+    event_subscription<void(A...)> _subscription;
+};
+
+template<class T>
+class event_distinct
+{
+};
+
+/// drops an event equal (operator==) to the previous one
+template<class... A>
+class event_distinct<void(A...)> : public event_stream<void(A...)>
+{
+    typedef event_stream_internal::event_value<A...> value_traits;
+public:
+    event_distinct(event_stream<void(A...)>& source) :
+        _subscription(source, [this](typename event_param<A>::type... args) { on_event(args...); })
+    {
+    }
+private:
+    void on_event(typename event_param<A>::type... args)
+    {
+        if constexpr (sizeof...(A) == 1) {
+            if (_last && *_last == std::get<0>(std::tie(args...))) return;
+        } else {
+            if (_last && *_last == std::tie(args...)) return;
+        }
+
+        value_traits::assign(_last, args...);
+        this->emit(args...);
+    }
+
+    std::optional<typename value_traits::type> _last;
+
+    event_subscription<void(A...)> _subscription;
+};
+
+template<class T>
+class event_merge
+{
+};
+
+/// forwards the events of several sources of the same signature
+template<class... A>
+class event_merge<void(A...)> : public event_stream<void(A...)>
+{
+public:
+    event_merge(std::initializer_list<event_stream<void(A...)>*> sources)
+    {
+        _subscriptions.reserve(sources.size());
+        for (auto source : sources) {
+            add(*source);
+        }
+    }
+
+    void add(event_stream<void(A...)>& source)
+    {
+        _subscriptions.emplace_back(source, [this](typename event_param<A>::type... args) { this->emit(args...); });
+    }
+private:
+    std::vector<event_subscription<void(A...)>> _subscriptions;
+};
+
+/// factories deducing the signature from the source
+///
+///     auto moves = ev::throttle(on_mouse_move, std::chrono::milliseconds(16));
+///     auto batches = ev::buffer(on_metric, 256, std::chrono::milliseconds(100));
+namespace ev {
+
+template<class... A>
+event_throttle<void(A...)> throttle(event_stream<void(A...)>& source, std::chrono::steady_clock::duration interval)
+{
+    return event_throttle<void(A...)>(source, interval);
+}
+
+template<class... A>
+event_debounce<void(A...)> debounce(event_stream<void(A...)>& source, std::chrono::steady_clock::duration interval)
+{
+    return event_debounce<void(A...)>(source, interval);
+}
+
+template<class... A>
+event_sample<void(A...)> sample(event_stream<void(A...)>& source, std::chrono::steady_clock::duration period)
+{
+    return event_sample<void(A...)>(source, period);
+}
+
+template<class... A>
+event_buffer<void(A...)> buffer(event_stream<void(A...)>& source, size_t count,
+    std::chrono::steady_clock::duration window = std::chrono::steady_clock::duration::zero())
+{
+    return event_buffer<void(A...)>(source, count, window);
+}
+
+template<class... A>
+event_buffer<void(A...)> buffer(event_stream<void(A...)>& source, std::chrono::steady_clock::duration window)
+{
+    return event_buffer<void(A...)>(source, window);
+}
+
+template<class... A>
+event_distinct<void(A...)> distinct_until_changed(event_stream<void(A...)>& source)
+{
+    return event_distinct<void(A...)>(source);
+}
+
+template<class... A, class... S>
+event_merge<void(A...)> merge(event_stream<void(A...)>& first, S&... rest)
+{
+    return event_merge<void(A...)>({ &first, &rest... });
+}
+
+}
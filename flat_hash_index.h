@@ -0,0 +1,99 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+/// open addressing index from hashes to entry indexes, the entries themselves
+/// live in the owner's own storage and never move for the index. fibonacci
+/// hashing picks the home bucket, collisions probe linearly and 'unlink' shifts
+/// the following entries back instead of leaving tombstones, so lookups stay
+/// short however many entries come and go.
+///
+/// the index keeps nothing but entry indexes, callers pass an entry's hash in
+/// and tell how to match a key or get a linked entry's hash back, keep the hash
+/// next to the key so most probes skip the key compare.
+class flat_hash_index
+{
+public:
+    enum : uint32_t { npos = 0xffffffff };
+
+    explicit flat_hash_index(size_t min_buckets = 8)
+    {
+        reset(min_buckets);
+    }
+
+    /// at least min_buckets buckets, a power of 2 and no less than 8, all empty,
+    /// to grow link every entry again afterwards
+    void reset(size_t min_buckets)
+    {
+        _shift = 64 - 3;
+        while ((size_t(1) << (64 - _shift)) < min_buckets) {
+            _shift--;
+        }
+
+        _mask = (size_t(1) << (64 - _shift)) - 1;
+        _buckets.assign(_mask + 1, npos);
+    }
+
+    size_t bucket_count() const
+    {
+        return _mask + 1;
+    }
+
+    /// the entry of hash that match(index) accepts, npos when there is none
+    template<class F>
+    uint32_t find(size_t hash, F match) const
+    {
+        for (size_t pos = bucket(hash); ; pos = (pos + 1) & _mask) {
+            uint32_t index = _buckets[pos];
+            if (index == npos || match(index))
+                return index;
+        }
+    }
+
+    /// the caller keeps at least one bucket empty
+    void link(uint32_t index, size_t hash)
+    {
+        size_t pos = bucket(hash);
+        while (_buckets[pos] != npos) {
+            pos = (pos + 1) & _mask;
+        }
+        _buckets[pos] = index;
+    }
+
+    /// index must be linked with hash, hash_of(other) gives the hash of any
+    /// other linked entry
+    template<class F>
+    void unlink(uint32_t index, size_t hash, F hash_of)
+    {
+        size_t pos = bucket(hash);
+        while (_buckets[pos] != index) {
+            pos = (pos + 1) & _mask;
+        }
+
+        size_t next = pos;
+        for (;;) {
+            next = (next + 1) & _mask;
+            if (_buckets[next] == npos) break;
+
+            size_t home = bucket(hash_of(_buckets[next]));
+            if (((next - home) & _mask) >= ((next - pos) & _mask)) {
+                _buckets[pos] = _buckets[next];
+                pos = next;
+            }
+        }
+        _buckets[pos] = npos;
+    }
+private:
+    size_t bucket(size_t hash) const
+    {
+        /// fibonacci hashing, std::hash is identity for integers
+        return size_t(uint64_t(hash) * 0x9E3779B97F4A7C15ull >> _shift);
+    }
+
+    std::vector<uint32_t> _buckets;
+
+    size_t _mask;
+
+    uint32_t _shift;
+};
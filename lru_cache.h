@@ -1,156 +1,1704 @@
 #pragma once
+#include "flat_hash_index.h"
 #include <stdint.h>
 #include <memory>
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <chrono>
+#include <type_traits>
+#include <utility>
+#include <atomic>
 #include <map>
+#include <set>
+#include <unordered_map>
+#include <string>
+#include <string_view>
+
+/// why an entry left the cache, a deletor taking a third parameter of this type
+/// gets it, 'void deletor(const K& k, V& v, lru_cache_removal reason)'
+enum class lru_cache_removal
+{
+    /// pushed out to make room, or too heavy to be cached at all
+    evicted,
+
+    /// k was inserted again
+    replaced,
+
+    /// its ttl ran out
+    expired,
+
+    /// clear, or the cache was destroyed
+    cleared,
+};
+
+namespace lru_cache_internal {
+
+/// ref-counted part of a cache node, the cache holds one reference while the
+/// entry is cached and every handle holds one, the deletor runs on the last release
+template<class V>
+struct lru_cache_pinned
+{
+    V _val;
+
+    std::atomic<uint32_t> _refs;
+
+    /// set when the entry leaves the cache, for the deletor of a deferred release
+    lru_cache_removal _removal;
+};
+
+template<class V>
+class lru_cache_releaser
+{
+public:
+    virtual void release(lru_cache_pinned<V>* pinned) = 0;
+};
+
+}
+
+/// pins a cached value, eviction (or expiry, or clear) of a pinned entry only
+/// removes it from the cache and defers the deletor until the last handle is
+/// released, so the value stays valid without being copied out.
+///
+/// handles must be released before the cache that produced them is destroyed.
+template<class V>
+class lru_cache_handle
+{
+public:
+    lru_cache_handle() :
+        _pinned(nullptr),
+        _owner(nullptr)
+    {
+    }
+
+    lru_cache_handle(lru_cache_internal::lru_cache_pinned<V>* pinned, lru_cache_internal::lru_cache_releaser<V>* owner) :
+        _pinned(pinned),
+        _owner(owner)
+    {
+        _pinned->_refs.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    lru_cache_handle(const lru_cache_handle& other) :
+        _pinned(other._pinned),
+        _owner(other._owner)
+    {
+        if (_pinned) {
+            _pinned->_refs.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    lru_cache_handle(lru_cache_handle&& other) :
+        _pinned(other._pinned),
+        _owner(other._owner)
+    {
+        other._pinned = nullptr;
+        other._owner = nullptr;
+    }
+
+    ~lru_cache_handle()
+    {
+        reset();
+    }
+
+    lru_cache_handle& operator=(lru_cache_handle other)
+    {
+        std::swap(_pinned, other._pinned);
+        std::swap(_owner, other._owner);
+        return *this;
+    }
+
+    void reset()
+    {
+        if (_pinned) {
+            if (_pinned->_refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                _owner->release(_pinned);
+            }
+            _pinned = nullptr;
+            _owner = nullptr;
+        }
+    }
+
+    explicit operator bool() const
+    {
+        return _pinned != nullptr;
+    }
+
+    const V& get() const
+    {
+        return _pinned->_val;
+    }
+
+    const V& operator*() const
+    {
+        return _pinned->_val;
+    }
+
+    const V* operator->() const
+    {
+        return &_pinned->_val;
+    }
+private:
+    lru_cache_internal::lru_cache_pinned<V>* _pinned;
+
+    lru_cache_internal::lru_cache_releaser<V>* _owner;
+};
+
+/// snapshot of cache counters, all zero unless compiled with LRU_CACHE_STATS
+/// (define it the same way in every translation unit including lru_cache.h).
+struct lru_cache_stats
+{
+    enum { latency_buckets = 24 };
+
+    uint64_t _hits = 0;
+
+    uint64_t _misses = 0;
+
+    /// creator returned false or threw
+    uint64_t _creator_failures = 0;
+
+    /// entries pushed out by max_cache_count or max_weight
+    uint64_t _evictions = 0;
+
+    /// entries dropped because their ttl ran out
+    uint64_t _expirations = 0;
+
+    uint32_t _size = 0;
+
+    uint64_t _weight = 0;
+
+    /// creator latency, bucket i counts calls under 2^i microseconds, the last one all slower calls
+    uint64_t _creator_latency[latency_buckets] = {};
+
+    double hit_ratio() const
+    {
+        uint64_t total = _hits + _misses;
+        return total == 0 ? 0 : double(_hits) / double(total);
+    }
+
+    lru_cache_stats& operator+=(const lru_cache_stats& other)
+    {
+        _hits += other._hits;
+        _misses += other._misses;
+        _creator_failures += other._creator_failures;
+        _evictions += other._evictions;
+        _expirations += other._expirations;
+        _size += other._size;
+        _weight += other._weight;
+        for (int i = 0; i < latency_buckets; i++) {
+            _creator_latency[i] += other._creator_latency[i];
+        }
+        return *this;
+    }
+};
+
+/// type lookups take instead of K, so a std::string keyed cache can be queried
+/// with a literal or a string_view without building a std::string, K is only
+/// constructed on a miss. specialize it for other keys with a cheap view type
+/// that is ordered and hashed like K.
+template<class K>
+struct lru_cache_key_view
+{
+    typedef K type;
+};
+
+template<>
+struct lru_cache_key_view<std::string>
+{
+    typedef std::string_view type;
+};
 
 namespace lru_cache_internal {
 
+/// misses of a query_many, each distinct key once, handed to one batch creator call
+template<class K, class V>
+class lru_cache_misses
+{
+public:
+    /// index maps a key to its place in _keys, the caller picks the container its
+    /// keys can be deduplicated in, a std::map or an unordered_map with its hasher
+    template<class I>
+    void add(I& index, const K& k, size_t position)
+    {
+        auto iter = index.find(k);
+        if (iter == index.end()) {
+            iter = index.emplace(k, _keys.size()).first;
+            _keys.push_back(k);
+        }
+        _positions.push_back(std::make_pair(position, iter->second));
+    }
+
+    /// find(k, v) over keys, records the misses in index, returns the found count
+    template<class I, class F>
+    uint32_t find_all(const std::vector<K>& keys, std::vector<V>& vals, std::vector<bool>& found, I& index, F find)
+    {
+        uint32_t count = 0;
+        for (size_t i = 0; i < keys.size(); i++) {
+            if (find(keys[i], vals[i])) {
+                found[i] = true;
+                count++;
+            } else {
+                add(index, keys[i], i);
+            }
+        }
+        return count;
+    }
+
+    bool empty() const
+    {
+        return _keys.empty();
+    }
+
+    template<class B>
+    void create(B& batch_creator)
+    {
+        _vals.assign(_keys.size(), V());
+        _created.assign(_keys.size(), false);
+        batch_creator(_keys, _vals, _created);
+    }
+
+    /// copies created values to every position that asked for them
+    uint32_t resolve(std::vector<V>& vals, std::vector<bool>& found)
+    {
+        uint32_t count = 0;
+        for (auto& pos : _positions) {
+            if (_created[pos.second]) {
+                vals[pos.first] = _vals[pos.second];
+                found[pos.first] = true;
+                count++;
+            }
+        }
+        return count;
+    }
+
+    std::vector<K> _keys;
+
+    std::vector<V> _vals;
+
+    std::vector<bool> _created;
+private:
+    std::vector<std::pair<size_t, size_t>> _positions;
+};
+
 template<class K, class V>
 class lru_cache_interface
 {
 public:
+    typedef typename lru_cache_key_view<K>::type key_view;
+
     virtual ~lru_cache_interface() { }
 
-    virtual bool query(const K& k, V& v) = 0;
+    virtual bool query(const key_view& k, V& v) = 0;
+
+    virtual void clear() = 0;
+
+    /// the pieces 'query' is made of, for front ends that must not run the
+    /// creator while holding their lock
+
+    /// lookup only, touches recency on hit
+    virtual bool find(const key_view& k, V& v) = 0;
+
+    /// find over every key, the misses go to 'misses' once per distinct key,
+    /// deduplicated the way the impl tells keys apart, returns the found count
+    virtual uint32_t find_many(const std::vector<K>& keys, std::vector<V>& vals, std::vector<bool>& found, lru_cache_misses<K, V>& misses) = 0;
+
+    /// caches v for k, an existing value of k is passed to the deletor
+    virtual void insert(const K& k, const V& v) = 0;
+
+    /// same, k and v are moved into the cache
+    virtual void insert(K&& k, V&& v) = 0;
+
+    /// same, k expires after ttl, 0 means never
+    virtual void insert(const K& k, const V& v, std::chrono::milliseconds ttl) = 0;
+
+    /// runs the creator, doesn't touch the cache and reads nothing a lock guards,
+    /// so it may run unlocked. ttl comes in as the entry's ttl (e.g. default_ttl()
+    /// read under the lock) and a creator taking a third 'milliseconds&' may change it
+    virtual bool create(const K& k, V& v, std::chrono::milliseconds& ttl) = 0;
+
+    /// ttl of entries cached without an explicit one, 0 means never expire
+    virtual void set_default_ttl(std::chrono::milliseconds ttl) = 0;
+
+    virtual std::chrono::milliseconds default_ttl() const = 0;
+
+    /// reclaims at most max_count expired entries, returns how many were reclaimed
+    virtual uint32_t expire(uint32_t max_count) = 0;
+
+    /// handle flavors of query/find/insert, the handle pins the value
+    virtual bool query(const key_view& k, lru_cache_handle<V>& h) = 0;
+
+    virtual bool find(const key_view& k, lru_cache_handle<V>& h) = 0;
+
+    /// h pins v even when v can't be cached (e.g. heavier than max_weight)
+    virtual void insert(const K& k, const V& v, std::chrono::milliseconds ttl, lru_cache_handle<V>& h) = 0;
+
+    /// adds counters, size and weight to s
+    virtual void stats(lru_cache_stats& s) const = 0;
+
+    /// visits every entry, least recently used first, func must not touch the cache
+    virtual void for_each(const std::function<void(const K&, const V&)>& func) const = 0;
+
+    /// number of cached entries
+    virtual uint32_t size() const = 0;
+
+    /// sum of the weigher over cached entries, equals size() without a weigher
+    virtual uint64_t weight() const = 0;
+};
+
+template<class T>
+class do_nothing_deletor
+{
+public:
+    void operator()(const T&)
+    {
+    }
+};
+
+/// for front ends that create values themselves and only use find/insert
+template<class K, class V>
+class null_creator
+{
+public:
+    bool operator()(const K&, V&)
+    {
+        return false;
+    }
+};
+
+/// the key to cache for a looked up key_view, k itself when it already is a K
+template<class K, class T>
+typename std::conditional<std::is_same<K, T>::value, const K&, K>::type make_key(const T& k)
+{
+    if constexpr (std::is_same<K, T>::value) {
+        return k;
+    } else {
+        return K(k);
+    }
+}
+
+/// creators may optionally take a third 'std::chrono::milliseconds& ttl'
+/// to give the created entry its own time-to-live
+template<class C, class K, class V>
+bool invoke_creator(C& creator, const K& k, V& v, std::chrono::milliseconds& ttl)
+{
+    if constexpr (std::is_invocable_v<C&, const K&, V&, std::chrono::milliseconds&>) {
+        return creator(k, v, ttl);
+    } else {
+        return creator(k, v);
+    }
+}
+
+/// a deletor may take the key too, 'void deletor(const K& k, V& v)', and the
+/// reason, 'void deletor(const K& k, V& v, lru_cache_removal reason)'
+template<class D, class K, class V>
+void invoke_deletor(D& deletor, const K& k, V& v, lru_cache_removal reason)
+{
+    if constexpr (std::is_invocable_v<D&, const K&, V&, lru_cache_removal>) {
+        deletor(k, v, reason);
+    } else if constexpr (std::is_invocable_v<D&, const K&, V&>) {
+        deletor(k, v);
+    } else {
+        deletor(v);
+    }
+}
+
+inline uint64_t steady_milliseconds()
+{
+    return uint64_t(std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+#ifdef LRU_CACHE_STATS
+
+/// relaxed atomics, they are bumped under a shard lock or, for the creator
+/// of a single_flight miss, with no lock at all
+class lru_cache_counters
+{
+public:
+    lru_cache_counters()
+    {
+        _hits = 0;
+        _misses = 0;
+        _creator_failures = 0;
+        _evictions = 0;
+        _expirations = 0;
+        for (auto& bucket : _creator_latency) {
+            bucket = 0;
+        }
+    }
+
+    /// policies and impls are copied around before use, counters start from zero
+    lru_cache_counters(const lru_cache_counters&) :
+        lru_cache_counters()
+    {
+    }
+
+    void hit()
+    {
+        _hits.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void miss()
+    {
+        _misses.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void evict()
+    {
+        _evictions.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void expire()
+    {
+        _expirations.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /// runs creator, recording its latency and whether it failed
+    template<class F>
+    bool create(F creator)
+    {
+        auto start = std::chrono::steady_clock::now();
+        bool success = false;
+        try {
+            success = creator();
+        } catch (...) {
+            created(start, false);
+            throw;
+        }
+
+        created(start, success);
+        return success;
+    }
+
+    void snapshot(lru_cache_stats& s) const
+    {
+        s._hits += _hits.load(std::memory_order_relaxed);
+        s._misses += _misses.load(std::memory_order_relaxed);
+        s._creator_failures += _creator_failures.load(std::memory_order_relaxed);
+        s._evictions += _evictions.load(std::memory_order_relaxed);
+        s._expirations += _expirations.load(std::memory_order_relaxed);
+        for (int i = 0; i < lru_cache_stats::latency_buckets; i++) {
+            s._creator_latency[i] += _creator_latency[i].load(std::memory_order_relaxed);
+        }
+    }
+private:
+    void created(std::chrono::steady_clock::time_point start, bool success)
+    {
+        auto micros = uint64_t(std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start).count());
+
+        int bucket = 0;
+        while (bucket < lru_cache_stats::latency_buckets - 1 && (micros >> bucket) != 0) {
+            bucket++;
+        }
+
+        _creator_latency[bucket].fetch_add(1, std::memory_order_relaxed);
+        if (!success) {
+            _creator_failures.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    std::atomic<uint64_t> _hits;
+
+    std::atomic<uint64_t> _misses;
+
+    std::atomic<uint64_t> _creator_failures;
+
+    std::atomic<uint64_t> _evictions;
+
+    std::atomic<uint64_t> _expirations;
+
+    std::atomic<uint64_t> _creator_latency[lru_cache_stats::latency_buckets];
+};
+
+#else
+
+/// stats disabled, every call inlines to nothing
+class lru_cache_counters
+{
+public:
+    void hit() {}
+
+    void miss() {}
+
+    void evict() {}
+
+    void expire() {}
+
+    template<class F>
+    bool create(F creator)
+    {
+        return creator();
+    }
+
+    void snapshot(lru_cache_stats&) const {}
+};
+
+#endif
+
+template<class V>
+struct default_deletor
+{
+    typedef typename std::_If<std::is_pointer<V>::value,
+        std::default_delete<typename std::remove_pointer<V>::type>,
+        do_nothing_deletor<V>>::type type;
+};
+
+template<class T>
+class unit_weigher
+{
+public:
+    uint64_t operator()(const T&) const
+    {
+        return 1;
+    }
+};
+
+/// intrusive part of a cache node that eviction policies work on
+struct lru_cache_link
+{
+    lru_cache_link* _prev;
+    lru_cache_link* _next;
+
+    uint64_t _weight;
+
+    uint32_t _segment;
+};
+
+/// doubly linked list with sentinels, front is the most recently used
+class lru_cache_list
+{
+public:
+    lru_cache_list()
+    {
+        _head._next = _head._prev = &_tail;
+        _tail._next = _tail._prev = &_head;
+    }
+
+    bool empty() const
+    {
+        return _head._next == &_tail;
+    }
+
+    lru_cache_link* back()
+    {
+        return empty() ? nullptr : _tail._prev;
+    }
+
+    void push_front(lru_cache_link* node)
+    {
+        auto prev = &_head;
+        auto next = _head._next;
+        prev->_next = node;
+        next->_prev = node;
+        node->_prev = prev;
+        node->_next = next;
+    }
+
+    void remove(lru_cache_link* node)
+    {
+        auto prev = node->_prev;
+        auto next = node->_next;
+        prev->_next = next;
+        next->_prev = prev;
+    }
+
+    void move_to_front(lru_cache_link* node)
+    {
+        if (node->_prev != &_head) {
+            remove(node);
+            push_front(node);
+        }
+    }
+
+    /// back to front, least recently used first
+    template<class F>
+    void for_each(F func) const
+    {
+        for (auto node = _tail._prev; node != &_head; node = node->_prev) {
+            func(node);
+        }
+    }
+private:
+    lru_cache_link _head;
+
+    lru_cache_link _tail;
+
+    lru_cache_list(const lru_cache_list&);
+
+    lru_cache_list& operator=(const lru_cache_list&);
+};
+
+/// eviction policy decides recency bookkeeping and who is evicted next,
+/// lru_cache_impl owns the nodes and calls
+///
+///     void init(uint32_t max_cache_count, uint64_t max_weight);
+///     void on_insert(lru_cache_link* node);
+///     void on_hit(lru_cache_link* node);
+///     void on_remove(lru_cache_link* node);
+///     lru_cache_link* victim();   /// nullptr when empty
+///     void for_each(F func) const;   /// every node, the next victim first
+
+/// plain lru, a single recency list
+class lru_policy
+{
+public:
+    lru_policy()
+    {
+    }
+
+    /// policies are passed as prototypes, copies start empty
+    lru_policy(const lru_policy&)
+    {
+    }
+
+    void init(uint32_t, uint64_t)
+    {
+    }
+
+    void on_insert(lru_cache_link* node)
+    {
+        _list.push_front(node);
+    }
+
+    void on_hit(lru_cache_link* node)
+    {
+        _list.move_to_front(node);
+    }
+
+    void on_remove(lru_cache_link* node)
+    {
+        _list.remove(node);
+    }
+
+    lru_cache_link* victim()
+    {
+        return _list.back();
+    }
+
+    template<class F>
+    void for_each(F func) const
+    {
+        _list.for_each(func);
+    }
+private:
+    lru_cache_list _list;
+};
+
+/// segmented lru, scan resistant. new entries go to probation and only a second
+/// hit promotes them to protected, victims are taken from probation first, so a
+/// one-pass scan churns probation and leaves the hot protected set alone. when
+/// protected outgrows its share its tail is demoted back to probation.
+class slru_policy
+{
+    enum
+    {
+        probation,
+        protected_,
+    };
+public:
+    /// protected_percent of count and weight may be held by protected entries
+    explicit slru_policy(uint32_t protected_percent = 80) :
+        _protected_percent(protected_percent)
+    {
+    }
+
+    slru_policy(const slru_policy& other) :
+        _protected_percent(other._protected_percent)
+    {
+    }
+
+    void init(uint32_t max_cache_count, uint64_t max_weight)
+    {
+        _max_protected_count = uint32_t(uint64_t(max_cache_count) * _protected_percent / 100);
+        _max_protected_weight = max_weight / 100 * _protected_percent;
+        _protected_count = 0;
+        _protected_weight = 0;
+    }
+
+    void on_insert(lru_cache_link* node)
+    {
+        node->_segment = probation;
+        _probation.push_front(node);
+    }
+
+    void on_hit(lru_cache_link* node)
+    {
+        if (node->_segment == protected_) {
+            _protected.move_to_front(node);
+            return;
+        }
+
+        _probation.remove(node);
+        node->_segment = protected_;
+        _protected.push_front(node);
+        _protected_count++;
+        _protected_weight += node->_weight;
+
+        while (_protected_count > _max_protected_count || _protected_weight > _max_protected_weight) {
+            auto tail = _protected.back();
+            _protected.remove(tail);
+            _protected_count--;
+            _protected_weight -= tail->_weight;
+
+            tail->_segment = probation;
+            _probation.push_front(tail);
+        }
+    }
+
+    void on_remove(lru_cache_link* node)
+    {
+        if (node->_segment == protected_) {
+            _protected.remove(node);
+            _protected_count--;
+            _protected_weight -= node->_weight;
+        } else {
+            _probation.remove(node);
+        }
+    }
+
+    lru_cache_link* victim()
+    {
+        auto node = _probation.back();
+        return node ? node : _protected.back();
+    }
+
+    template<class F>
+    void for_each(F func) const
+    {
+        _probation.for_each(func);
+        _protected.for_each(func);
+    }
+private:
+    uint32_t _protected_percent;
+
+    uint32_t _max_protected_count = 0;
+
+    uint64_t _max_protected_weight = 0;
+
+    uint32_t _protected_count = 0;
+
+    uint64_t _protected_weight = 0;
+
+    lru_cache_list _probation;
+
+    lru_cache_list _protected;
+};
+
+/// intrusive part of a cache node that the timer wheel works on
+struct lru_cache_timer
+{
+    lru_cache_timer* _timer_prev;
+    lru_cache_timer* _timer_next;
+
+    /// steady_milliseconds when the entry expires, 0 means never
+    uint64_t _expire;
+};
+
+/// hierarchical timer wheel, 4 levels of 64 slots over 16ms ticks (~1s, ~1min,
+/// ~1h, ~3 days per level), adding and removing are O(1) and an entry is only
+/// moved when its slot of a coarser level cascades, expired entries are never
+/// found by scanning live ones
+class lru_cache_timer_wheel
+{
+    enum
+    {
+        tick_milliseconds = 16,
+        level_bits = 6,
+        level_slots = 1 << level_bits,
+        levels = 4,
+    };
+public:
+    lru_cache_timer_wheel()
+    {
+        for (auto& level : _slots) {
+            for (auto& slot : level) {
+                slot._timer_next = slot._timer_prev = &slot;
+            }
+        }
+
+        _current_tick = steady_milliseconds() / tick_milliseconds;
+        _count = 0;
+    }
+
+    void add(lru_cache_timer* timer)
+    {
+        /// rounded up, an entry is never reclaimed before its expiry
+        uint64_t tick = (timer->_expire + tick_milliseconds - 1) / tick_milliseconds;
+        if (_count++ == 0) {
+            _current_tick = std::max(_current_tick, steady_milliseconds() / tick_milliseconds);
+        }
+
+        place(timer, tick);
+    }
+
+    void remove(lru_cache_timer* timer)
+    {
+        timer->_timer_prev->_timer_next = timer->_timer_next;
+        timer->_timer_next->_timer_prev = timer->_timer_prev;
+        _count--;
+    }
+
+    /// pops one timer due at or before now, nullptr when there is none
+    lru_cache_timer* pop(uint64_t now)
+    {
+        uint64_t now_tick = now / tick_milliseconds;
+        for (;;) {
+            auto& slot = _slots[0][_current_tick & (level_slots - 1)];
+            if (slot._timer_next != &slot) {
+                auto timer = slot._timer_next;
+                remove(timer);
+                return timer;
+            }
+
+            if (_current_tick >= now_tick) return nullptr;
+
+            if (_count == 0) {
+                _current_tick = now_tick;
+                continue;
+            }
+
+            _current_tick++;
+            cascade();
+        }
+    }
+private:
+    void place(lru_cache_timer* timer, uint64_t tick)
+    {
+        tick = std::max(tick, _current_tick);
+
+        uint32_t level = 0;
+        while (level + 1 < levels && tick - _current_tick >= (uint64_t(1) << (level_bits * (level + 1)))) {
+            level++;
+        }
+
+        /// beyond the last level, park it in the farthest slot and re-place on cascade
+        uint64_t range = uint64_t(1) << (level_bits * levels);
+        if (tick - _current_tick >= range) {
+            tick = _current_tick + range - 1;
+        }
+
+        auto& slot = _slots[level][(tick >> (level_bits * level)) & (level_slots - 1)];
+        timer->_timer_prev = &slot;
+        timer->_timer_next = slot._timer_next;
+        slot._timer_next->_timer_prev = timer;
+        slot._timer_next = timer;
+    }
+
+    /// entering a tick whose lower level indices wrapped pulls the matching
+    /// slot of the coarser level down
+    void cascade()
+    {
+        for (uint32_t level = 1; level < levels; level++) {
+            if ((_current_tick & ((uint64_t(1) << (level_bits * level)) - 1)) != 0) break;
+
+            auto& slot = _slots[level][(_current_tick >> (level_bits * level)) & (level_slots - 1)];
+            lru_cache_timer pending;
+            if (slot._timer_next == &slot) continue;
+
+            pending._timer_next = slot._timer_next;
+            pending._timer_prev = slot._timer_prev;
+            pending._timer_next->_timer_prev = &pending;
+            pending._timer_prev->_timer_next = &pending;
+            slot._timer_next = slot._timer_prev = &slot;
+
+            while (pending._timer_next != &pending) {
+                auto timer = pending._timer_next;
+                pending._timer_next = timer->_timer_next;
+                timer->_timer_next->_timer_prev = &pending;
+                place(timer, (timer->_expire + tick_milliseconds - 1) / tick_milliseconds);
+            }
+        }
+    }
+
+    lru_cache_timer _slots[levels][level_slots];
+
+    /// ticks before it are fully processed
+    uint64_t _current_tick;
+
+    uint32_t _count;
+
+    lru_cache_timer_wheel(const lru_cache_timer_wheel&);
+
+    lru_cache_timer_wheel& operator=(const lru_cache_timer_wheel&);
+};
+
+template<class K, class V, class C, class D = default_deletor<V>::type, class W = unit_weigher<V>, class P = lru_policy>
+class lru_cache_impl : public lru_cache_interface<K, V>, public lru_cache_releaser<V>
+{
+    typedef typename lru_cache_key_view<K>::type key_view;
+
+    struct lru_cache_node : public lru_cache_link, public lru_cache_timer, public lru_cache_pinned<V>
+    {
+        K _key;
+    };
+
+    /// the index holds node pointers ordered by the key inside the node, so each
+    /// key is stored once, and compares against key_view for heterogeneous lookup
+    struct lru_cache_node_less
+    {
+        typedef void is_transparent;
+
+        bool operator()(lru_cache_node* a, lru_cache_node* b) const
+        {
+            return a->_key < b->_key;
+        }
+
+        template<class T>
+        bool operator()(const lru_cache_node* a, const T& b) const
+        {
+            return a->_key < b;
+        }
+
+        template<class T>
+        bool operator()(const T& a, const lru_cache_node* b) const
+        {
+            return a < b->_key;
+        }
+    };
+public:
+    lru_cache_impl(uint32_t max_cache_count, C creator = C(), D deletor = D(), P policy = P()) :
+        _max_cache_count(max_cache_count),
+        _max_weight(UINT64_MAX),
+        _creator(creator),
+        _deletor(deletor),
+        _policy(policy)
+    {
+        _policy.init(_max_cache_count, _max_weight);
+        _default_ttl = std::chrono::milliseconds(0);
+        _size = 0;
+        _weight = 0;
+    }
+
+    /// evicts until both max_cache_count and max_weight hold,
+    /// a value heavier than max_weight alone is returned but not cached
+    lru_cache_impl(uint32_t max_cache_count, uint64_t max_weight, C creator, D deletor, W weigher, P policy = P()) :
+        _max_cache_count(max_cache_count),
+        _max_weight(max_weight),
+        _creator(creator),
+        _deletor(deletor),
+        _weigher(weigher),
+        _policy(policy)
+    {
+        _policy.init(_max_cache_count, _max_weight);
+        _default_ttl = std::chrono::milliseconds(0);
+        _size = 0;
+        _weight = 0;
+    }
+
+    ~lru_cache_impl()
+    {
+        clear();
+    }
+private:
+    bool query(const key_view& k, V& v)
+    {
+        if (find(k, v)) return true;
+
+        K key = make_key<K>(k);
+        std::chrono::milliseconds ttl = _default_ttl;
+        bool success = create(key, v, ttl);
+        if (!success) return false;
+
+        insert_node(std::move(key), v, ttl);
+        return true;
+    }
+
+    bool query(const key_view& k, lru_cache_handle<V>& h)
+    {
+        if (find(k, h)) return true;
+
+        K key = make_key<K>(k);
+        V v;
+        std::chrono::milliseconds ttl = _default_ttl;
+        bool success = create(key, v, ttl);
+        if (!success) return false;
+
+        insert_pinned(std::move(key), std::move(v), ttl, h);
+        return true;
+    }
+
+    bool find(const key_view& k, V& v)
+    {
+        auto node = find_node(k);
+        if (node == nullptr) return false;
+
+        v = node->_val;
+        return true;
+    }
+
+    bool find(const key_view& k, lru_cache_handle<V>& h)
+    {
+        auto node = find_node(k);
+        if (node == nullptr) return false;
+
+        h = lru_cache_handle<V>(node, this);
+        return true;
+    }
+
+    /// keys are told apart by operator<, like the node index does
+    uint32_t find_many(const std::vector<K>& keys, std::vector<V>& vals, std::vector<bool>& found, lru_cache_misses<K, V>& misses)
+    {
+        std::map<K, size_t> index;
+        return misses.find_all(keys, vals, found, index, [this](const K& k, V& v) { return find(k, v); });
+    }
+
+    void insert(const K& k, const V& v)
+    {
+        insert_node(k, v, _default_ttl);
+    }
+
+    void insert(K&& k, V&& v)
+    {
+        insert_node(std::move(k), std::move(v), _default_ttl);
+    }
+
+    void insert(const K& k, const V& v, std::chrono::milliseconds ttl)
+    {
+        insert_node(k, v, ttl);
+    }
+
+    void insert(const K& k, const V& v, std::chrono::milliseconds ttl, lru_cache_handle<V>& h)
+    {
+        insert_pinned(k, v, ttl, h);
+    }
+
+    bool create(const K& k, V& v, std::chrono::milliseconds& ttl)
+    {
+        return _counters.create([&] { return invoke_creator(_creator, k, v, ttl); });
+    }
+
+    void set_default_ttl(std::chrono::milliseconds ttl)
+    {
+        _default_ttl = ttl;
+    }
+
+    std::chrono::milliseconds default_ttl() const
+    {
+        return _default_ttl;
+    }
+
+    uint32_t expire(uint32_t max_count)
+    {
+        if (_wheel == nullptr) return 0;
+
+        uint64_t now = steady_milliseconds();
+
+        uint32_t count = 0;
+        while (count < max_count) {
+            auto timer = _wheel->pop(now);
+            if (timer == nullptr) break;
+
+            auto node = static_cast<lru_cache_node*>(timer);
+            node->_expire = 0;
+            remove(node, lru_cache_removal::expired);
+            _counters.expire();
+            count++;
+        }
+        return count;
+    }
+
+    uint32_t size() const
+    {
+        return _size;
+    }
+
+    uint64_t weight() const
+    {
+        return _weight;
+    }
+
+    void stats(lru_cache_stats& s) const
+    {
+        _counters.snapshot(s);
+        s._size += _size;
+        s._weight += _weight;
+    }
+
+    void for_each(const std::function<void(const K&, const V&)>& func) const
+    {
+        _policy.for_each([&](lru_cache_link* link) {
+            auto node = static_cast<lru_cache_node*>(link);
+            func(node->_key, node->_val);
+        });
+    }
+
+    void clear()
+    {
+        while (auto node = _policy.victim()) {
+            remove(static_cast<lru_cache_node*>(node), lru_cache_removal::cleared);
+        }
+    }
+
+    /// last handle of an entry no longer cached is gone
+    void release(lru_cache_pinned<V>* pinned)
+    {
+        /// freed even when the deletor throws
+        std::unique_ptr<lru_cache_node> node(static_cast<lru_cache_node*>(pinned));
+        invoke_deletor(_deletor, node->_key, node->_val, node->_removal);
+    }
+
+    lru_cache_node* find_node(const key_view& k)
+    {
+        auto iter = _nodes.find(k);
+        if (iter == _nodes.end()) {
+            _counters.miss();
+            return nullptr;
+        }
+
+        auto node = *iter;
+        if (node->_expire != 0 && node->_expire <= steady_milliseconds()) {
+            remove(node, lru_cache_removal::expired);
+            _counters.expire();
+            _counters.miss();
+            return nullptr;
+        }
+
+        _policy.on_hit(node);
+        _counters.hit();
+        return node;
+    }
+
+    /// nullptr when v can't be cached, k and v are left untouched then
+    template<class KK, class VV>
+    lru_cache_node* insert_node(KK&& k, VV&& v, std::chrono::milliseconds ttl)
+    {
+        if (_max_cache_count == 0) return nullptr;
+
+        auto iter = _nodes.find(k);
+        if (iter != _nodes.end()) {
+            remove(*iter, lru_cache_removal::replaced);
+        }
+
+        uint64_t weight = _weigher(v);
+        if (weight > _max_weight) return nullptr;
+
+        while (_size == _max_cache_count || _weight + weight > _max_weight) {
+            remove(static_cast<lru_cache_node*>(_policy.victim()), lru_cache_removal::evicted);
+            _counters.evict();
+        }
+
+        lru_cache_node* node = new lru_cache_node;
+        node->_key = std::forward<KK>(k);
+        node->_val = std::forward<VV>(v);
+        node->_refs = 1;
+        node->_weight = weight;
+        node->_expire = 0;
+
+        if (ttl.count() > 0) {
+            node->_expire = steady_milliseconds() + uint64_t(ttl.count());
+            timer_wheel().add(node);
+        }
+
+        _nodes.insert(node);
+        _weight += weight;
+        _size++;
+        _policy.on_insert(node);
+        return node;
+    }
+
+    template<class KK, class VV>
+    void insert_pinned(KK&& k, VV&& v, std::chrono::milliseconds ttl, lru_cache_handle<V>& h)
+    {
+        auto node = insert_node(std::forward<KK>(k), std::forward<VV>(v), ttl);
+        if (node == nullptr) {
+            /// not cacheable, the handle is its only owner
+            node = new lru_cache_node;
+            node->_key = std::forward<KK>(k);
+            node->_val = std::forward<VV>(v);
+            node->_refs = 0;
+            node->_removal = lru_cache_removal::evicted;
+        }
 
-    virtual void clear() = 0;
-};
+        h = lru_cache_handle<V>(node, this);
+    }
 
-template<class T>
-class do_nothing_deletor
-{
-public:
-    void operator()(const T&)
+    lru_cache_timer_wheel& timer_wheel()
     {
+        if (_wheel == nullptr) {
+            _wheel.reset(new lru_cache_timer_wheel);
+        }
+        return *_wheel;
     }
-};
 
-template<class V>
-struct default_deletor
-{
-    typedef typename std::_If<std::is_pointer<V>::value,
-        std::default_delete<typename std::remove_pointer<V>::type>,
-        do_nothing_deletor<V>>::type type;
+    /// drops the cache's reference, pinned entries live on until their last handle
+    void remove(lru_cache_node* node, lru_cache_removal reason)
+    {
+        if (node->_expire != 0) {
+            _wheel->remove(node);
+        }
+
+        _policy.on_remove(node);
+        _nodes.erase(node);
+        _weight -= node->_weight;
+        _size--;
+        node->_removal = reason;
+
+        if (node->_refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            release(node);
+        }
+    }
+
+    uint32_t _size;
+
+    uint64_t _weight;
+
+    uint32_t _max_cache_count;
+
+    uint64_t _max_weight;
+
+    std::set<lru_cache_node*, lru_cache_node_less> _nodes;
+
+    C _creator;
+
+    D _deletor;
+
+    W _weigher;
+
+    P _policy;
+
+    std::chrono::milliseconds _default_ttl;
+
+    /// allocated for the first entry with a ttl, caches without ttls don't carry it
+    std::unique_ptr<lru_cache_timer_wheel> _wheel;
+
+    lru_cache_counters _counters;
 };
 
-template<class K, class V, class C, class D = default_deletor<V>::type>
-class lru_cache_impl : public lru_cache_interface<K, V>
+/// same algorithm as lru_cache_impl, but nodes live in a slab preallocated to
+/// max_cache_count and linked by index, located by an open-addressing hash
+/// index, so 'query' never allocates once the cache is constructed. slots don't
+/// move, so the timer wheel links them in place like lru_cache_impl's nodes.
+///
+/// eviction skips pinned slots, it takes the least recently used unpinned one,
+/// and when every slot is pinned a new value isn't cached. a pinned slot that
+/// expires or is replaced leaves the cache but keeps its place in the slab until
+/// its last handle is released, the releasing thread hands it back through a
+/// lock-free list, meanwhile the cache holds fewer than max_cache_count entries.
+/// H hashes key_view, std::hash<std::string_view> hashes a std::string like std::hash<std::string> does
+template<class K, class V, class C, class D = default_deletor<V>::type, class H = std::hash<typename lru_cache_key_view<K>::type>>
+class lru_cache_hash_impl : public lru_cache_interface<K, V>, public lru_cache_releaser<V>
 {
-    struct lru_cache_node
+    typedef typename lru_cache_key_view<K>::type key_view;
+
+    enum : uint32_t { npos = 0xffffffff };
+
+    /// slot 0 is the sentinel of the circular recency list, a free slot is
+    /// linked into the free list through _next
+    struct lru_cache_slot : public lru_cache_timer, public lru_cache_pinned<V>
     {
         K _key;
-        V _val;
 
-        lru_cache_node* _prev;
-        lru_cache_node* _next;
+        size_t _hash;
+
+        uint32_t _prev;
+        uint32_t _next;
     };
 public:
-    lru_cache_impl(uint32_t max_cache_count, C creator = C(), D deletor = D()) :
+    lru_cache_hash_impl(uint32_t max_cache_count, C creator = C(), D deletor = D(), H hasher = H()) :
         _max_cache_count(max_cache_count),
+        _slots(max_cache_count + 1),
+        _index(size_t(max_cache_count) * 2),
         _creator(creator),
-        _deletor(deletor)
+        _deletor(deletor),
+        _hasher(hasher)
     {
-        _head._next = _head._prev = &_tail;
-        _tail._next = _tail._prev = &_head;
+        _slots[0]._next = _slots[0]._prev = 0;
+        _free = npos;
+        _released = npos;
+        for (uint32_t index = max_cache_count; index > 0; index--) {
+            _slots[index]._next = _free;
+            _free = index;
+        }
+
+        _default_ttl = std::chrono::milliseconds(0);
         _size = 0;
     }
 
-    ~lru_cache_impl()
+    ~lru_cache_hash_impl()
     {
         clear();
     }
 private:
-    bool query(const K& k, V& v)
+    bool query(const key_view& k, V& v)
     {
-        auto iter = _nodes.find(k);
-        if (iter != _nodes.end()) {
-            auto node = iter->second;
-            if (node->_prev != &_head) {
-                detach(node);
-                attach(node);
+        if (find(k, v)) return true;
+
+        K key = make_key<K>(k);
+        std::chrono::milliseconds ttl = _default_ttl;
+        bool success = create(key, v, ttl);
+        if (!success) return false;
+
+        insert_slot(std::move(key), v, ttl);
+        return true;
+    }
+
+    bool query(const key_view& k, lru_cache_handle<V>& h)
+    {
+        if (find(k, h)) return true;
+
+        K key = make_key<K>(k);
+        V v;
+        std::chrono::milliseconds ttl = _default_ttl;
+        bool success = create(key, v, ttl);
+        if (!success) return false;
+
+        insert_pinned(std::move(key), std::move(v), ttl, h);
+        return true;
+    }
+
+    bool find(const key_view& k, V& v)
+    {
+        uint32_t index = find_slot(k);
+        if (index == npos) return false;
+
+        v = _slots[index]._val;
+        return true;
+    }
+
+    bool find(const key_view& k, lru_cache_handle<V>& h)
+    {
+        uint32_t index = find_slot(k);
+        if (index == npos) return false;
+
+        h = lru_cache_handle<V>(&_slots[index], this);
+        return true;
+    }
+
+    /// keys are told apart by the cache's own hasher
+    uint32_t find_many(const std::vector<K>& keys, std::vector<V>& vals, std::vector<bool>& found, lru_cache_misses<K, V>& misses)
+    {
+        std::unordered_map<K, size_t, H> index(keys.size(), _hasher);
+        return misses.find_all(keys, vals, found, index, [this](const K& k, V& v) { return find(k, v); });
+    }
+
+    void insert(const K& k, const V& v)
+    {
+        insert_slot(k, v, _default_ttl);
+    }
+
+    void insert(K&& k, V&& v)
+    {
+        insert_slot(std::move(k), std::move(v), _default_ttl);
+    }
+
+    void insert(const K& k, const V& v, std::chrono::milliseconds ttl)
+    {
+        insert_slot(k, v, ttl);
+    }
+
+    void insert(const K& k, const V& v, std::chrono::milliseconds ttl, lru_cache_handle<V>& h)
+    {
+        insert_pinned(k, v, ttl, h);
+    }
+
+    uint32_t find_slot(const key_view& k)
+    {
+        uint32_t index = find_index(k, _hasher(k));
+        if (index == npos) {
+            _counters.miss();
+            return npos;
+        }
+
+        auto& slot = _slots[index];
+        if (slot._expire != 0 && slot._expire <= steady_milliseconds()) {
+            remove(index, lru_cache_removal::expired);
+            _counters.expire();
+            _counters.miss();
+            return npos;
+        }
+
+        if (_slots[0]._next != index) {
+            detach(index);
+            attach(index);
+        }
+
+        _counters.hit();
+        return index;
+    }
+
+    /// npos when every slot is pinned, k and v are left untouched then
+    template<class KK, class VV>
+    uint32_t insert_slot(KK&& k, VV&& v, std::chrono::milliseconds ttl)
+    {
+        if (_max_cache_count == 0) return npos;
+
+        size_t hash = _hasher(k);
+        uint32_t index = find_index(k, hash);
+        if (index != npos) {
+            remove(index, lru_cache_removal::replaced);
+        }
+
+        if (_free == npos) {
+            reclaim();
+        }
+
+        if (_free == npos) {
+            uint32_t victim = _slots[0]._prev;
+            while (victim != 0 && _slots[victim]._refs.load(std::memory_order_relaxed) != 1) {
+                victim = _slots[victim]._prev;
             }
+            if (victim == 0) return npos;
 
-            v = node->_val;
-            return true;
+            remove(victim, lru_cache_removal::evicted);
+            _counters.evict();
         }
 
-        bool success = _creator(k, v);
-        if (!success) return false;
+        index = _free;
+        auto& slot = _slots[index];
+        _free = slot._next;
 
-        if (_size == _max_cache_count) {
-            auto node = _tail._prev;
-            detach(node, true);
+        slot._key = std::forward<KK>(k);
+        slot._val = std::forward<VV>(v);
+        slot._refs.store(1, std::memory_order_relaxed);
+        slot._hash = hash;
+        slot._expire = 0;
+
+        if (ttl.count() > 0) {
+            slot._expire = steady_milliseconds() + uint64_t(ttl.count());
+            timer_wheel().add(&slot);
         }
 
-        lru_cache_node* node = new lru_cache_node;
-        node->_key = k;
-        node->_val = v;
-        attach(node, true);
+        link(index);
+        attach(index);
+        _size++;
+        return index;
+    }
 
-        return true;
+    template<class KK, class VV>
+    void insert_pinned(KK&& k, VV&& v, std::chrono::milliseconds ttl, lru_cache_handle<V>& h)
+    {
+        uint32_t index = insert_slot(std::forward<KK>(k), std::forward<VV>(v), ttl);
+        if (index != npos) {
+            h = lru_cache_handle<V>(&_slots[index], this);
+            return;
+        }
+
+        /// not cacheable, a slot outside the slab that the handle owns alone
+        auto slot = new lru_cache_slot;
+        slot->_key = std::forward<KK>(k);
+        slot->_val = std::forward<VV>(v);
+        slot->_refs = 0;
+        slot->_removal = lru_cache_removal::evicted;
+        h = lru_cache_handle<V>(slot, this);
     }
 
-    void clear()
+    bool create(const K& k, V& v, std::chrono::milliseconds& ttl)
     {
-        auto node = _head._next;
-        while (node != &_tail) {
-            auto next = node->_next;
-            detach(node, true);
-            node = next;
+        return _counters.create([&] { return invoke_creator(_creator, k, v, ttl); });
+    }
+
+    void set_default_ttl(std::chrono::milliseconds ttl)
+    {
+        _default_ttl = ttl;
+    }
+
+    std::chrono::milliseconds default_ttl() const
+    {
+        return _default_ttl;
+    }
+
+    uint32_t expire(uint32_t max_count)
+    {
+        if (_wheel == nullptr) return 0;
+
+        uint64_t now = steady_milliseconds();
+
+        uint32_t count = 0;
+        while (count < max_count) {
+            auto timer = _wheel->pop(now);
+            if (timer == nullptr) break;
+
+            auto slot = static_cast<lru_cache_slot*>(timer);
+            slot->_expire = 0;
+            remove(uint32_t(slot - _slots.data()), lru_cache_removal::expired);
+            _counters.expire();
+            count++;
         }
+        return count;
+    }
+
+    uint32_t size() const
+    {
+        return _size;
+    }
+
+    uint64_t weight() const
+    {
+        return _size;
     }
 
-    lru_cache_node _head;
+    void stats(lru_cache_stats& s) const
+    {
+        _counters.snapshot(s);
+        s._size += _size;
+        s._weight += _size;
+    }
 
-    lru_cache_node _tail;
+    void for_each(const std::function<void(const K&, const V&)>& func) const
+    {
+        for (auto index = _slots[0]._prev; index != 0; index = _slots[index]._prev) {
+            func(_slots[index]._key, _slots[index]._val);
+        }
+    }
 
-    uint32_t _size;
+    void clear()
+    {
+        while (_slots[0]._next != 0) {
+            remove(_slots[0]._next, lru_cache_removal::cleared);
+        }
+    }
 
-    void attach(lru_cache_node* node, bool insert = false)
+    /// last handle of a slot no longer cached is gone, may run on any thread
+    void release(lru_cache_pinned<V>* pinned)
     {
-        auto prev = &_head;
-        auto next = _head._next;
-        prev->_next = node;
-        next->_prev = node;
-        node->_prev = prev;
-        node->_next = next;
+        auto slot = static_cast<lru_cache_slot*>(pinned);
+        invoke_deletor(_deletor, slot->_key, slot->_val, slot->_removal);
 
-        if (insert) {
-            _nodes.emplace(node->_key, node);
-            _size++;
+        std::less<const lru_cache_slot*> less;
+        if (less(slot, _slots.data()) || !less(slot, _slots.data() + _slots.size())) {
+            delete slot;
+            return;
         }
+
+        slot->_key = K();
+        slot->_val = V();
+
+        uint32_t index = uint32_t(slot - _slots.data());
+        uint32_t head = _released.load(std::memory_order_relaxed);
+        do {
+            slot->_next = head;
+        } while (!_released.compare_exchange_weak(head, index, std::memory_order_release, std::memory_order_relaxed));
     }
 
-    void detach(lru_cache_node* node, bool remove = false)
+    /// moves released slots to the free list, they are only ever pushed by
+    /// release and taken all at once here, so there is no aba
+    void reclaim()
     {
-        auto prev = node->_prev;
-        auto next = node->_next;
-        prev->_next = next;
-        next->_prev = prev;
+        uint32_t index = _released.exchange(npos, std::memory_order_acquire);
+        while (index != npos) {
+            uint32_t next = _slots[index]._next;
+            _slots[index]._next = _free;
+            _free = index;
+            index = next;
+        }
+    }
+
+    lru_cache_timer_wheel& timer_wheel()
+    {
+        if (_wheel == nullptr) {
+            _wheel.reset(new lru_cache_timer_wheel);
+        }
+        return *_wheel;
+    }
 
-        if (remove) {
-            _deletor(node->_val);
-            _nodes.erase(node->_key);
-            delete node;
-            _size--;
+    /// takes a cached slot out of the index, the recency list and the wheel and
+    /// drops the cache's reference, a pinned slot is freed by its last handle
+    void remove(uint32_t index, lru_cache_removal reason)
+    {
+        auto& slot = _slots[index];
+        if (slot._expire != 0) {
+            _wheel->remove(&slot);
         }
+
+        detach(index);
+        unlink(index);
+        _size--;
+        slot._removal = reason;
+
+        if (slot._refs.fetch_sub(1, std::memory_order_acq_rel) != 1) return;
+
+        invoke_deletor(_deletor, slot._key, slot._val, reason);
+        slot._key = K();
+        slot._val = V();
+
+        slot._next = _free;
+        _free = index;
+    }
+
+    uint32_t find_index(const key_view& k, size_t hash) const
+    {
+        return _index.find(hash, [&](uint32_t index) {
+            auto& slot = _slots[index];
+            return slot._hash == hash && slot._key == k;
+        });
+    }
+
+    void link(uint32_t index)
+    {
+        _index.link(index, _slots[index]._hash);
+    }
+
+    void unlink(uint32_t index)
+    {
+        _index.unlink(index, _slots[index]._hash, [this](uint32_t other) { return _slots[other]._hash; });
+    }
+
+    void attach(uint32_t index)
+    {
+        auto& slot = _slots[index];
+        auto next = _slots[0]._next;
+        slot._prev = 0;
+        slot._next = next;
+        _slots[next]._prev = index;
+        _slots[0]._next = index;
+    }
+
+    void detach(uint32_t index)
+    {
+        auto& slot = _slots[index];
+        _slots[slot._prev]._next = slot._next;
+        _slots[slot._next]._prev = slot._prev;
     }
 
     uint32_t _max_cache_count;
 
-    std::map<K, lru_cache_node*> _nodes;
+    uint32_t _size;
+
+    std::vector<lru_cache_slot> _slots;
+
+    /// head of the free slots, npos when all are cached or pinned
+    uint32_t _free;
+
+    /// head of the slots released by their last handle, not yet on _free
+    std::atomic<uint32_t> _released;
+
+    /// twice max_cache_count buckets, never grows
+    flat_hash_index _index;
 
     C _creator;
 
     D _deletor;
+
+    H _hasher;
+
+    std::chrono::milliseconds _default_ttl;
+
+    /// allocated for the first entry with a ttl, caches without ttls don't carry it
+    std::unique_ptr<lru_cache_timer_wheel> _wheel;
+
+    lru_cache_counters _counters;
 };
 
 }
 
+/// pass to lru_cache constructor to select lru_cache_hash_impl
+struct lru_cache_hashed_t
+{
+};
+
+const lru_cache_hashed_t lru_cache_hashed = {};
+
+/// eviction policies for lru_cache_impl
+typedef lru_cache_internal::lru_policy lru_cache_lru_policy;
+
+typedef lru_cache_internal::slru_policy lru_cache_slru_policy;
+
 template<class K, class V>
 class lru_cache
 {
 public:
+    typedef typename lru_cache_key_view<K>::type key_view;
+
     template<class C, class D>
     lru_cache(uint32_t max_cache_count, C creator, D deletor) :
         _impl(new lru_cache_internal::lru_cache_impl<K, V, C, D>(max_cache_count, creator, deletor))
@@ -163,20 +1711,167 @@ public:
     {
     }
 
+    template<class C, class D>
+    lru_cache(uint32_t max_cache_count, C creator, D deletor, lru_cache_hashed_t) :
+        _impl(new lru_cache_internal::lru_cache_hash_impl<K, V, C, D>(max_cache_count, creator, deletor))
+    {
+    }
+
+    template<class C>
+    lru_cache(uint32_t max_cache_count, C creator, lru_cache_hashed_t) :
+        _impl(new lru_cache_internal::lru_cache_hash_impl<K, V, C>(max_cache_count, creator))
+    {
+    }
+
+    /// hasher hashes key_view, for keys std::hash doesn't cover
+    template<class C, class D, class H>
+    lru_cache(uint32_t max_cache_count, C creator, D deletor, lru_cache_hashed_t, H hasher) :
+        _impl(new lru_cache_internal::lru_cache_hash_impl<K, V, C, D, H>(max_cache_count, creator, deletor, hasher))
+    {
+    }
+
+    /// weigher returns the cost of a value (e.g. its bytes), entries are evicted
+    /// until the total cost fits max_weight and the count fits max_cache_count
+    template<class C, class D, class W>
+    lru_cache(uint32_t max_cache_count, uint64_t max_weight, C creator, D deletor, W weigher) :
+        _impl(new lru_cache_internal::lru_cache_impl<K, V, C, D, W>(max_cache_count, max_weight, creator, deletor, weigher))
+    {
+    }
+
+    /// policy picks the eviction order, e.g. lru_cache_slru_policy
+    /// to keep one-off scans from flushing the hot entries
+    template<class C, class D, class P>
+    lru_cache(uint32_t max_cache_count, C creator, D deletor, P policy) :
+        _impl(new lru_cache_internal::lru_cache_impl<K, V, C, D,
+            lru_cache_internal::unit_weigher<V>, P>(max_cache_count, creator, deletor, policy))
+    {
+    }
+
+    template<class C, class D, class W, class P>
+    lru_cache(uint32_t max_cache_count, uint64_t max_weight, C creator, D deletor, W weigher, P policy) :
+        _impl(new lru_cache_internal::lru_cache_impl<K, V, C, D, W, P>(max_cache_count, max_weight, creator, deletor, weigher, policy))
+    {
+    }
+
     ~lru_cache()
     {
         delete _impl;
     }
 
-    bool query(const K& k, V& v)
+    /// k may be a key_view (e.g. a string_view or a literal for std::string keys),
+    /// a K is only built on a miss
+    bool query(const key_view& k, V& v)
     {
         return _impl->query(k, v);
     }
 
+    /// zero-copy flavor, the returned handle pins the value so later queries
+    /// can't evict and delete it under you, empty when the creator fails
+    lru_cache_handle<V> query(const key_view& k)
+    {
+        lru_cache_handle<V> h;
+        _impl->query(k, h);
+        return h;
+    }
+
+    /// batch creator sample:
+    ///
+    ///     void batch_creator(const std::vector<K>& keys, std::vector<V>& vals, std::vector<bool>& created);
+    ///
+    /// vals and created come sized to keys, set created[i] for every vals[i] produced.
+    ///
+    /// resolves all hits in one pass and hands every distinct missing key to a single
+    /// batch_creator call, found[i] tells whether vals[i] is valid, returns the found count
+    template<class B>
+    uint32_t query_many(const std::vector<K>& keys, std::vector<V>& vals, std::vector<bool>& found, B batch_creator)
+    {
+        vals.assign(keys.size(), V());
+        found.assign(keys.size(), false);
+
+        lru_cache_internal::lru_cache_misses<K, V> misses;
+        uint32_t count = _impl->find_many(keys, vals, found, misses);
+
+        if (misses.empty()) return count;
+
+        misses.create(batch_creator);
+        for (size_t i = 0; i < misses._keys.size(); i++) {
+            if (misses._created[i]) {
+                _impl->insert(misses._keys[i], misses._vals[i]);
+            }
+        }
+
+        return count + misses.resolve(vals, found);
+    }
+
+    /// loads the missing ones of keys with a single batch_creator call
+    template<class B>
+    void prefetch(const std::vector<K>& keys, B batch_creator)
+    {
+        std::vector<V> vals;
+        std::vector<bool> found;
+        query_many(keys, vals, found, batch_creator);
+    }
+
     void clear()
     {
         _impl->clear();
     }
+
+    uint32_t size() const
+    {
+        return _impl->size();
+    }
+
+    uint64_t weight() const
+    {
+        return _impl->weight();
+    }
+
+    /// counters are only maintained when compiled with LRU_CACHE_STATS
+    lru_cache_stats stats() const
+    {
+        lru_cache_stats s;
+        _impl->stats(s);
+        return s;
+    }
+
+    /// caches v without calling creator, replacing any entry of k
+    void insert(const K& k, const V& v)
+    {
+        _impl->insert(k, v);
+    }
+
+    void insert(K&& k, V&& v)
+    {
+        _impl->insert(std::move(k), std::move(v));
+    }
+
+    /// builds the value from args and moves it into the cache
+    template<class... Args>
+    void emplace(K k, Args&&... args)
+    {
+        _impl->insert(std::move(k), V(std::forward<Args>(args)...));
+    }
+
+    /// least recently used first, func must not touch the cache
+    template<class F>
+    void for_each(F func) const
+    {
+        _impl->for_each(func);
+    }
+
+    /// entries expire ttl after they are cached, checked lazily by 'query',
+    /// a creator taking a third 'std::chrono::milliseconds& ttl' can override it per entry
+    void set_default_ttl(std::chrono::milliseconds ttl)
+    {
+        _impl->set_default_ttl(ttl);
+    }
+
+    /// reclaims up to max_count expired entries without waiting for a 'query' to hit them
+    uint32_t expire(uint32_t max_count)
+    {
+        return _impl->expire(max_count);
+    }
 private:
     lru_cache_internal::lru_cache_interface<K, V>* _impl;
 
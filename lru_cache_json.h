@@ -0,0 +1,21 @@
+#pragma once
+#include "lru_cache.h"
+#include "rapidjson.h"
+#include <iterator>
+
+/// writes lru_cache_stats through the json_writer helpers:
+///
+///     json_buffer buffer = json_serialize([&](json_writer& w) { w << cache.stats(); });
+inline void operator<<(json_object_writer& oo, const lru_cache_stats& s)
+{
+    oo["hits"] << s._hits;
+    oo["misses"] << s._misses;
+    oo["hit_ratio"] << float(s.hit_ratio());
+    oo["creator_failures"] << s._creator_failures;
+    oo["evictions"] << s._evictions;
+    oo["expirations"] << s._expirations;
+    oo["size"] << s._size;
+    oo["weight"] << s._weight;
+    oo["creator_latency"] << std::vector<uint64_t>(
+        std::begin(s._creator_latency), std::end(s._creator_latency));
+}
@@ -0,0 +1,294 @@
+#pragma once
+#include "lru_cache.h"
+#include <string.h>
+#include <errno.h>
+#include <string>
+#include <fstream>
+#include <filesystem>
+#include <stdexcept>
+#include <type_traits>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+/// how a key or value is laid out in a snapshot, trivially copyable types are
+/// copied bytewise, specialize it for anything else:
+///
+///     static void write(std::string& out, const T& t);
+///     static bool read(const char*& pos, const char* end, T& t);   /// false when truncated
+///
+/// a value type without one (pointers, by default) can still be saved keys-only
+template<class T, class = void>
+struct lru_cache_serializer
+{
+};
+
+template<class T>
+struct lru_cache_serializer<T, typename std::enable_if<
+    std::is_trivially_copyable<T>::value && !std::is_pointer<T>::value>::type>
+{
+    static void write(std::string& out, const T& t)
+    {
+        out.append(reinterpret_cast<const char*>(&t), sizeof(T));
+    }
+
+    static bool read(const char*& pos, const char* end, T& t)
+    {
+        if (size_t(end - pos) < sizeof(T)) return false;
+
+        memcpy(&t, pos, sizeof(T));
+        pos += sizeof(T);
+        return true;
+    }
+};
+
+template<>
+struct lru_cache_serializer<std::string>
+{
+    static void write(std::string& out, const std::string& t)
+    {
+        uint32_t size = uint32_t(t.size());
+        out.append(reinterpret_cast<const char*>(&size), sizeof(size));
+        out.append(t);
+    }
+
+    static bool read(const char*& pos, const char* end, std::string& t)
+    {
+        uint32_t size = 0;
+        if (!lru_cache_serializer<uint32_t>::read(pos, end, size)) return false;
+        if (size_t(end - pos) < size) return false;
+
+        t.assign(pos, size);
+        pos += size;
+        return true;
+    }
+};
+
+namespace lru_cache_internal {
+
+/// read-only mapping of a whole file, the file may still be appended to by a
+/// writer, the mapping just doesn't see what was written after open
+class lru_cache_mapped_file
+{
+public:
+    /// false when the file doesn't exist
+    bool open(const std::string& path)
+    {
+#ifdef _WIN32
+        _file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE,
+            NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (_file == INVALID_HANDLE_VALUE) {
+            if (GetLastError() == ERROR_FILE_NOT_FOUND) return false;
+            throw std::runtime_error("lru_cache_snapshot, open file");
+        }
+
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(_file, &size))
+            throw std::runtime_error("lru_cache_snapshot, file size");
+
+        _size = size_t(size.QuadPart);
+        if (_size == 0) return true;
+
+        _mapping = CreateFileMappingA(_file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (_mapping == NULL)
+            throw std::runtime_error("lru_cache_snapshot, map file");
+
+        _data = static_cast<const char*>(MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0));
+        if (_data == nullptr)
+            throw std::runtime_error("lru_cache_snapshot, map file");
+#else
+        _file = ::open(path.c_str(), O_RDONLY);
+        if (_file < 0) {
+            if (errno == ENOENT) return false;
+            throw std::runtime_error("lru_cache_snapshot, open file");
+        }
+
+        struct stat st;
+        if (fstat(_file, &st) != 0)
+            throw std::runtime_error("lru_cache_snapshot, file size");
+
+        _size = size_t(st.st_size);
+        if (_size == 0) return true;
+
+        void* data = mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, _file, 0);
+        if (data == MAP_FAILED)
+            throw std::runtime_error("lru_cache_snapshot, map file");
+
+        _data = static_cast<const char*>(data);
+        madvise(data, _size, MADV_SEQUENTIAL);
+#endif
+        return true;
+    }
+
+    ~lru_cache_mapped_file()
+    {
+#ifdef _WIN32
+        if (_data) UnmapViewOfFile(_data);
+        if (_mapping) CloseHandle(_mapping);
+        if (_file != INVALID_HANDLE_VALUE) CloseHandle(_file);
+#else
+        if (_data) munmap(const_cast<char*>(_data), _size);
+        if (_file >= 0) ::close(_file);
+#endif
+    }
+
+    const char* begin() const
+    {
+        return _data;
+    }
+
+    const char* end() const
+    {
+        return _data + _size;
+    }
+private:
+#ifdef _WIN32
+    HANDLE _file = INVALID_HANDLE_VALUE;
+
+    HANDLE _mapping = NULL;
+#else
+    int _file = -1;
+#endif
+
+    const char* _data = nullptr;
+
+    size_t _size = 0;
+};
+
+template<class S, class T, class = void>
+struct lru_cache_serializable : std::false_type
+{
+};
+
+template<class S, class T>
+struct lru_cache_serializable<S, T, std::void_t<decltype(
+    S::write(std::declval<std::string&>(), std::declval<const T&>()))>> : std::true_type
+{
+};
+
+struct lru_cache_snapshot_header
+{
+    char _magic[4];
+
+    uint32_t _version;
+
+    uint32_t _flags;
+
+    uint32_t _count;
+};
+
+}
+
+/// warm start for lru_cache and concurrent_lru_cache.
+///
+/// 'save' writes every key, and the value when with_values is set, least recently
+/// used first, so 'load' inserting them in file order restores the recency order.
+/// a snapshot with values is inserted without calling creator, a keys-only one
+/// calls 'query' for each key, which still saves the time spent finding out
+/// what is hot. ttl isn't saved, loaded entries get the default ttl.
+///
+///     lru_cache_snapshot<std::string, token>::save(tokens, "tokens.snapshot", true);
+///     ...
+///     lru_cache_snapshot<std::string, token>::load(tokens, "tokens.snapshot");
+template<class K, class V, class KS = lru_cache_serializer<K>, class VS = lru_cache_serializer<V>>
+class lru_cache_snapshot
+{
+    enum : uint32_t
+    {
+        version = 1,
+        with_values_flag = 1,
+    };
+
+    static constexpr bool values_serializable = lru_cache_internal::lru_cache_serializable<VS, V>::value;
+public:
+    /// written to path + ".tmp" and renamed over path, a crash never leaves half a snapshot
+    template<class Cache>
+    static void save(const Cache& cache, const std::string& path, bool with_values)
+    {
+        if (with_values && !values_serializable)
+            throw std::logic_error("lru_cache_snapshot, value type has no serializer");
+
+        std::string data(sizeof(lru_cache_internal::lru_cache_snapshot_header), '\0');
+
+        uint32_t count = 0;
+        cache.for_each([&](const K& k, const V& v) {
+            KS::write(data, k);
+            if constexpr (values_serializable) {
+                if (with_values) {
+                    VS::write(data, v);
+                }
+            }
+            count++;
+        });
+
+        lru_cache_internal::lru_cache_snapshot_header header;
+        memcpy(header._magic, "LRUS", 4);
+        header._version = version;
+        header._flags = with_values ? uint32_t(with_values_flag) : 0u;
+        header._count = count;
+        memcpy(&data[0], &header, sizeof(header));
+
+        std::string temp_path = path + ".tmp";
+        {
+            std::ofstream file(temp_path, std::ios::binary | std::ios::trunc);
+            file.write(data.data(), std::streamsize(data.size()));
+            file.close();
+            if (!file)
+                throw std::runtime_error("lru_cache_snapshot, write file");
+        }
+
+        std::filesystem::rename(temp_path, path);
+    }
+
+    /// returns how many entries were cached, 0 when there is no snapshot yet
+    template<class Cache>
+    static uint32_t load(Cache& cache, const std::string& path)
+    {
+        lru_cache_internal::lru_cache_mapped_file file;
+        if (!file.open(path)) return 0;
+
+        const char* pos = file.begin();
+        const char* end = file.end();
+
+        lru_cache_internal::lru_cache_snapshot_header header;
+        if (size_t(end - pos) < sizeof(header))
+            throw std::runtime_error("lru_cache_snapshot, bad snapshot");
+
+        memcpy(&header, pos, sizeof(header));
+        pos += sizeof(header);
+        if (memcmp(header._magic, "LRUS", 4) != 0 || header._version != version)
+            throw std::runtime_error("lru_cache_snapshot, bad snapshot");
+
+        bool with_values = (header._flags & with_values_flag) != 0;
+
+        uint32_t count = 0;
+        K k;
+        V v;
+        for (uint32_t i = 0; i < header._count; i++) {
+            if (!KS::read(pos, end, k))
+                throw std::runtime_error("lru_cache_snapshot, bad snapshot");
+
+            if (!with_values) {
+                if (cache.query(k, v)) count++;
+                continue;
+            }
+
+            if constexpr (values_serializable) {
+                if (!VS::read(pos, end, v))
+                    throw std::runtime_error("lru_cache_snapshot, bad snapshot");
+
+                cache.insert(k, v);
+                count++;
+            } else {
+                throw std::logic_error("lru_cache_snapshot, value type has no serializer");
+            }
+        }
+        return count;
+    }
+};
@@ -0,0 +1,141 @@
+/// single_flight contention of concurrent_lru_cache, exits 1 on the first failure.
+///
+///     contention  16 threads miss the same key at once, key by key, every 5th key
+///                 throws. every key must be created once and every thread must see
+///                 the exception of a failing key.
+///     insert      the loader's insert throws (the deletor of the entry it evicts
+///                 throws), the waiters get the exception and later queries of the
+///                 key don't block on the abandoned flight.
+///
+///     cl /O2 /std:c++20 /EHsc /I.. concurrent_lru_cache_test.cpp
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <barrier>
+#include <chrono>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "concurrent_lru_cache.h"
+
+enum : uint32_t {
+    thread_count = 16,
+    key_count = 20,
+};
+
+static void check(bool condition, const char* what) {
+    if (!condition) {
+        printf("FAILED: %s\n", what);
+        exit(1);
+    }
+}
+
+/// a hang is a failure too
+static void watchdog() {
+    std::thread([] {
+        std::this_thread::sleep_for(std::chrono::seconds(30));
+        printf("FAILED: timed out\n");
+        exit(1);
+    }).detach();
+}
+
+static void contention() {
+    std::atomic<uint32_t> calls[key_count];
+    for (auto& count : calls) {
+        count = 0;
+    }
+
+    /// long enough for every thread to queue behind the first one
+    auto creator = [&calls](const uint64_t& k, uint64_t& v) {
+        calls[k]++;
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        if (k % 5 == 0)
+            throw std::runtime_error("creator failed");
+
+        v = k * 2;
+        return true;
+    };
+    concurrent_lru_cache<uint64_t, uint64_t> cache(key_count, 4, creator, concurrent_lru_cache_mode::single_flight);
+
+    std::atomic<uint32_t> failures[key_count];
+    std::atomic<uint32_t> wrong{ 0 };
+    for (auto& count : failures) {
+        count = 0;
+    }
+
+    std::barrier round(thread_count);
+    std::vector<std::thread> threads;
+    for (uint32_t t = 0; t < thread_count; t++) {
+        threads.emplace_back([&] {
+            for (uint64_t k = 0; k < key_count; k++) {
+                round.arrive_and_wait();
+                uint64_t v = 0;
+                try {
+                    if (!cache.query(k, v) || v != k * 2) {
+                        wrong++;
+                    }
+                } catch (const std::runtime_error&) {
+                    failures[k]++;
+                }
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    for (uint64_t k = 0; k < key_count; k++) {
+        check(calls[k] == 1, "one creator call per key");
+        check(failures[k] == (k % 5 == 0 ? uint32_t(thread_count) : 0u), "the exception reaches every waiter");
+    }
+    check(wrong == 0, "waiters get the created value");
+    printf("contention  ok\n");
+}
+
+static void insert_failure() {
+    /// the deletor of value 1 throws, capacity 1 so caching any other key evicts it
+    auto creator = [](const uint64_t& k, uint64_t& v) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        v = k;
+        return true;
+    };
+    auto deletor = [](uint64_t& v) {
+        if (v == 1)
+            throw std::runtime_error("deletor failed");
+    };
+    concurrent_lru_cache<uint64_t, uint64_t> cache(1, 1, creator, deletor, concurrent_lru_cache_mode::single_flight);
+
+    uint64_t v = 0;
+    check(cache.query(1, v), "cache the poisoned value");
+
+    std::atomic<uint32_t> failures{ 0 };
+    std::barrier start(thread_count);
+    std::vector<std::thread> threads;
+    for (uint32_t t = 0; t < thread_count; t++) {
+        threads.emplace_back([&] {
+            start.arrive_and_wait();
+            uint64_t v = 0;
+            try {
+                cache.query(2, v);
+            } catch (const std::runtime_error&) {
+                failures++;
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    check(failures == thread_count, "an insert failure reaches every waiter");
+
+    check(cache.query(2, v) && v == 2, "the key is queried again after a failed insert");
+    printf("insert      ok\n");
+}
+
+int main() {
+    watchdog();
+    contention();
+    insert_failure();
+    return 0;
+}
@@ -0,0 +1,638 @@
+#pragma once
+#include "lru_cache.h"
+#include "lru_cache_snapshot.h"
+#include <stdio.h>
+#include <string.h>
+#include <list>
+#include <map>
+#include <memory>
+#include <string>
+#include <functional>
+#include <filesystem>
+
+namespace lru_cache_internal {
+
+/// byte oriented lz77, a sequence is 'literal count, literals, match length,
+/// match offset', lengths and offsets are varints and the last sequence has
+/// match length 0. no entropy coding, it is meant to be cheaper than a creator
+/// call, not small.
+class lru_cache_lz
+{
+    enum
+    {
+        min_match = 4,
+        hash_bits = 12,
+        max_offset = 0xffff,
+    };
+public:
+    static void compress(const std::string& in, std::string& out)
+    {
+        uint32_t table[1 << hash_bits] = {};
+
+        const char* base = in.data();
+        size_t size = in.size();
+        size_t anchor = 0;
+        size_t pos = 0;
+        while (size >= min_match && pos <= size - min_match) {
+            uint32_t seq;
+            memcpy(&seq, base + pos, 4);
+            uint32_t slot = (seq * 2654435761u) >> (32 - hash_bits);
+
+            size_t candidate = table[slot];
+            table[slot] = uint32_t(pos + 1);
+            if (candidate == 0 || pos - (candidate - 1) > max_offset
+                || memcmp(base + candidate - 1, base + pos, min_match) != 0) {
+                pos++;
+                continue;
+            }
+
+            size_t match = candidate - 1;
+            size_t length = min_match;
+            while (pos + length < size && base[match + length] == base[pos + length]) {
+                length++;
+            }
+
+            write_varint(out, pos - anchor);
+            out.append(base + anchor, pos - anchor);
+            write_varint(out, length);
+            write_varint(out, pos - match);
+
+            pos += length;
+            anchor = pos;
+        }
+
+        write_varint(out, size - anchor);
+        out.append(base + anchor, size - anchor);
+        write_varint(out, 0);
+    }
+
+    /// false when in is corrupt
+    static bool decompress(const char* pos, const char* end, std::string& out)
+    {
+        while (pos < end) {
+            size_t literals = 0;
+            if (!read_varint(pos, end, literals) || size_t(end - pos) < literals) return false;
+
+            out.append(pos, literals);
+            pos += literals;
+
+            size_t length = 0;
+            if (!read_varint(pos, end, length)) return false;
+            if (length == 0) break;
+
+            size_t offset = 0;
+            if (!read_varint(pos, end, offset) || offset == 0 || offset > out.size()) return false;
+
+            /// may overlap itself, copy byte by byte
+            size_t from = out.size() - offset;
+            for (size_t i = 0; i < length; i++) {
+                out.push_back(out[from + i]);
+            }
+        }
+        return pos == end;
+    }
+private:
+    static void write_varint(std::string& out, size_t val)
+    {
+        while (val >= 0x80) {
+            out.push_back(char(val | 0x80));
+            val >>= 7;
+        }
+        out.push_back(char(val));
+    }
+
+    static bool read_varint(const char*& pos, const char* end, size_t& val)
+    {
+        val = 0;
+        for (int shift = 0; pos < end && shift < 64; shift += 7) {
+            uint8_t byte = uint8_t(*pos++);
+            val |= size_t(byte & 0x7f) << shift;
+            if ((byte & 0x80) == 0) return true;
+        }
+        return false;
+    }
+};
+
+/// recency and byte accounting shared by the l2 stores, E is the per-entry payload
+template<class K, class E>
+class lru_cache_store_index
+{
+    struct lru_cache_store_entry
+    {
+        E _payload;
+
+        size_t _size;
+
+        typename std::list<const K*>::iterator _recency;
+    };
+public:
+    explicit lru_cache_store_index(uint64_t max_bytes) :
+        _max_bytes(max_bytes),
+        _bytes(0)
+    {
+    }
+
+    /// false when k isn't stored, otherwise moves its payload out and forgets it
+    bool take(const K& k, E& payload, size_t& size)
+    {
+        auto iter = _entries.find(k);
+        if (iter == _entries.end()) return false;
+
+        payload = std::move(iter->second._payload);
+        size = iter->second._size;
+        erase(iter);
+        return true;
+    }
+
+    /// replaces any entry of k, then drops least recently demoted entries until
+    /// max_bytes holds, on_drop sees every payload dropped that way
+    template<class F>
+    void put(const K& k, E&& payload, size_t size, F on_drop)
+    {
+        auto iter = _entries.find(k);
+        if (iter != _entries.end()) {
+            on_drop(iter->second._payload, iter->second._size);
+            erase(iter);
+        }
+
+        iter = _entries.emplace(k, lru_cache_store_entry{ std::move(payload), size, {} }).first;
+        _recency.push_front(&iter->first);
+        iter->second._recency = _recency.begin();
+        _bytes += size;
+
+        while (_bytes > _max_bytes) {
+            auto victim = _entries.find(*_recency.back());
+            on_drop(victim->second._payload, victim->second._size);
+            erase(victim);
+        }
+    }
+
+    /// least recently demoted first
+    template<class F>
+    void for_each(F func)
+    {
+        for (auto iter = _recency.rbegin(); iter != _recency.rend(); ++iter) {
+            auto& entry = _entries.find(**iter)->second;
+            func(entry._payload, entry._size);
+        }
+    }
+
+    void clear()
+    {
+        _entries.clear();
+        _recency.clear();
+        _bytes = 0;
+    }
+
+    uint32_t size() const
+    {
+        return uint32_t(_entries.size());
+    }
+
+    uint64_t bytes() const
+    {
+        return _bytes;
+    }
+private:
+    void erase(typename std::map<K, lru_cache_store_entry>::iterator iter)
+    {
+        _bytes -= iter->second._size;
+        _recency.erase(iter->second._recency);
+        _entries.erase(iter);
+    }
+
+    uint64_t _max_bytes;
+
+    uint64_t _bytes;
+
+    std::map<K, lru_cache_store_entry> _entries;
+
+    std::list<const K*> _recency;
+};
+
+}
+
+/// l2 kept in memory, every value is lz compressed (or kept raw when that
+/// doesn't shrink it), max_bytes bounds the compressed bytes
+template<class K>
+class lru_cache_compressed_store
+{
+    enum : char
+    {
+        raw,
+        compressed,
+    };
+public:
+    explicit lru_cache_compressed_store(uint64_t max_bytes) :
+        _index(max_bytes)
+    {
+    }
+
+    void put(const K& k, const std::string& bytes)
+    {
+        std::string data(1, compressed);
+        lru_cache_internal::lru_cache_lz::compress(bytes, data);
+        if (data.size() > bytes.size()) {
+            data.assign(1, raw);
+            data.append(bytes);
+        }
+
+        size_t size = data.size();
+        _index.put(k, std::move(data), size, [](std::string&, size_t) {});
+    }
+
+    bool take(const K& k, std::string& bytes)
+    {
+        std::string data;
+        size_t size;
+        if (!_index.take(k, data, size)) return false;
+
+        bytes.clear();
+        if (data[0] == raw) {
+            bytes.assign(data, 1, std::string::npos);
+            return true;
+        }
+
+        if (!lru_cache_internal::lru_cache_lz::decompress(data.data() + 1, data.data() + data.size(), bytes))
+            throw std::runtime_error("lru_cache_compressed_store, corrupt entry");
+        return true;
+    }
+
+    void clear()
+    {
+        _index.clear();
+    }
+
+    uint32_t size() const
+    {
+        return _index.size();
+    }
+
+    uint64_t bytes() const
+    {
+        return _index.bytes();
+    }
+private:
+    lru_cache_internal::lru_cache_store_index<K, std::string> _index;
+};
+
+/// l2 in a local file, values are appended and read back through a read-only
+/// mapping of the file. taking or dropping an entry only leaves a hole, the file
+/// is rewritten without the holes once they outweigh the live bytes. the file is
+/// scratch space, it is truncated on construction.
+///
+/// the file is grown ahead of the appends, doubling each time, and mapped whole,
+/// so appended values are read through the mapping already there and it is only
+/// remapped when the file grows or is compacted.
+template<class K>
+class lru_cache_file_store
+{
+    enum : uint64_t
+    {
+        min_compact_bytes = 1 << 20,
+        min_capacity_bytes = 1 << 20,
+    };
+public:
+    lru_cache_file_store(const std::string& path, uint64_t max_bytes) :
+        _path(path),
+        _index(max_bytes),
+        _file(nullptr),
+        _file_bytes(0),
+        _capacity_bytes(0),
+        _flushed_bytes(0),
+        _dead_bytes(0)
+    {
+        reopen("w+b");
+    }
+
+    ~lru_cache_file_store()
+    {
+        _mapping.reset();
+        close();
+    }
+
+    void put(const K& k, const std::string& bytes)
+    {
+        if (_file_bytes + bytes.size() > _capacity_bytes) {
+            grow(_file_bytes + bytes.size());
+        }
+
+        if (fwrite(bytes.data(), 1, bytes.size(), _file) != bytes.size())
+            throw std::runtime_error("lru_cache_file_store, write file");
+
+        uint64_t offset = _file_bytes;
+        _file_bytes += bytes.size();
+        _index.put(k, std::move(offset), bytes.size(), [this](uint64_t&, size_t size) {
+            _dead_bytes += size;
+        });
+
+        if (_dead_bytes > min_compact_bytes && _dead_bytes > _index.bytes()) {
+            compact();
+        }
+    }
+
+    bool take(const K& k, std::string& bytes)
+    {
+        uint64_t offset;
+        size_t size;
+        if (!_index.take(k, offset, size)) return false;
+
+        _dead_bytes += size;
+        if (size == 0) {
+            bytes.clear();
+        } else {
+            bytes.assign(map(offset, size), size);
+        }
+        return true;
+    }
+
+    void clear()
+    {
+        _index.clear();
+        _mapping.reset();
+        close();
+        reopen("w+b");
+        _file_bytes = 0;
+        _capacity_bytes = 0;
+        _flushed_bytes = 0;
+        _dead_bytes = 0;
+    }
+
+    uint32_t size() const
+    {
+        return _index.size();
+    }
+
+    uint64_t bytes() const
+    {
+        return _index.bytes();
+    }
+private:
+    void reopen(const char* mode)
+    {
+        _file = fopen(_path.c_str(), mode);
+        if (_file == nullptr)
+            throw std::runtime_error("lru_cache_file_store, open file");
+    }
+
+    /// null before anything may throw, so the destructor doesn't close it twice
+    void close()
+    {
+        FILE* file = _file;
+        _file = nullptr;
+        if (file) {
+            fclose(file);
+        }
+    }
+
+    /// at least doubles the file, the unwritten tail reads as zeros
+    void grow(uint64_t needed)
+    {
+        uint64_t capacity = _capacity_bytes < min_capacity_bytes ? min_capacity_bytes : _capacity_bytes;
+        while (capacity < needed) {
+            capacity *= 2;
+        }
+
+        _mapping.reset();
+        std::error_code error;
+        std::filesystem::resize_file(_path, capacity, error);
+        if (error)
+            throw std::runtime_error("lru_cache_file_store, resize file");
+
+        _capacity_bytes = capacity;
+    }
+
+    /// flushes when [offset, offset + size) is still in the stdio buffer, maps
+    /// the file when it grew or was compacted since the last call
+    const char* map(uint64_t offset, size_t size)
+    {
+        if (offset + size > _flushed_bytes) {
+            if (fflush(_file) != 0)
+                throw std::runtime_error("lru_cache_file_store, flush file");
+
+            _flushed_bytes = _file_bytes;
+        }
+
+        if (_mapping == nullptr) {
+            std::unique_ptr<lru_cache_internal::lru_cache_mapped_file> mapping(new lru_cache_internal::lru_cache_mapped_file);
+            if (!mapping->open(_path))
+                throw std::runtime_error("lru_cache_file_store, map file");
+
+            _mapping = std::move(mapping);
+        }
+        return _mapping->begin() + offset;
+    }
+
+    void compact()
+    {
+        std::string temp_path = _path + ".compact";
+        FILE* temp = fopen(temp_path.c_str(), "wb");
+        if (temp == nullptr)
+            throw std::runtime_error("lru_cache_file_store, open file");
+
+        uint64_t temp_bytes = 0;
+        _index.for_each([&](uint64_t& offset, size_t size) {
+            if (fwrite(map(offset, size), 1, size, temp) != size) {
+                fclose(temp);
+                throw std::runtime_error("lru_cache_file_store, write file");
+            }
+            offset = temp_bytes;
+            temp_bytes += size;
+        });
+        fclose(temp);
+
+        _mapping.reset();
+        close();
+        std::filesystem::rename(temp_path, _path);
+        reopen("r+b");
+        if (fseek(_file, 0, SEEK_END) != 0)
+            throw std::runtime_error("lru_cache_file_store, seek file");
+
+        _file_bytes = temp_bytes;
+        _capacity_bytes = temp_bytes;
+        _flushed_bytes = temp_bytes;
+        _dead_bytes = 0;
+    }
+
+    std::string _path;
+
+    lru_cache_internal::lru_cache_store_index<K, uint64_t> _index;
+
+    FILE* _file;
+
+    std::unique_ptr<lru_cache_internal::lru_cache_mapped_file> _mapping;
+
+    /// end of the appended values
+    uint64_t _file_bytes;
+
+    /// size of the file, appends past it grow the file first
+    uint64_t _capacity_bytes;
+
+    /// appended values below this are in the file, not only in the stdio buffer
+    uint64_t _flushed_bytes;
+
+    uint64_t _dead_bytes;
+private:
+    lru_cache_file_store(const lru_cache_file_store&);
+
+    lru_cache_file_store& operator=(const lru_cache_file_store&);
+};
+
+/// two-tier lru_cache. entries evicted from the in-memory l1 are serialized
+/// into store S (lru_cache_compressed_store or lru_cache_file_store), a miss in
+/// l1 that hits the store promotes the entry back instead of calling creator.
+/// values go through lru_cache_serializer (or VS), a pointer value needs a
+/// serializer that allocates on read. single-threaded, like lru_cache.
+///
+///     tiered_lru_cache<std::string, std::string, lru_cache_file_store<std::string>> pages(
+///         1024, new lru_cache_file_store<std::string>("pages.l2", 1ull << 30), load_page);
+template<class K, class V, class S, class VS = lru_cache_serializer<V>>
+class tiered_lru_cache
+{
+    typedef typename lru_cache_key_view<K>::type key_view;
+
+    struct tier_creator
+    {
+        bool operator()(const K& k, V& v)
+        {
+            return _owner->promote(k, v) || _creator(k, v);
+        }
+
+        tiered_lru_cache* _owner;
+
+        std::function<bool(const K&, V&)> _creator;
+    };
+
+    struct tier_deletor
+    {
+        /// runs the user deletor even when demote throws
+        struct deletor_guard
+        {
+            ~deletor_guard()
+            {
+                _deletor(_k, _v, _reason);
+            }
+
+            std::function<void(const K&, V&, lru_cache_removal)>& _deletor;
+
+            const K& _k;
+
+            V& _v;
+
+            lru_cache_removal _reason;
+        };
+
+        /// only values evicted for room go to l2, replaced or expired ones are
+        /// stale and cleared ones are dropped with the store
+        void operator()(const K& k, V& v, lru_cache_removal reason)
+        {
+            deletor_guard guard{ _deletor, k, v, reason };
+            if (reason == lru_cache_removal::evicted) {
+                _owner->demote(k, v);
+            }
+        }
+
+        tiered_lru_cache* _owner;
+
+        /// the user deletor in any of the forms lru_cache takes
+        std::function<void(const K&, V&, lru_cache_removal)> _deletor;
+    };
+public:
+    /// takes ownership of store
+    template<class C, class D>
+    tiered_lru_cache(uint32_t max_cache_count, S* store, C creator, D deletor) :
+        _store(store)
+    {
+        init(max_cache_count, creator, deletor);
+    }
+
+    template<class C>
+    tiered_lru_cache(uint32_t max_cache_count, S* store, C creator) :
+        _store(store)
+    {
+        init(max_cache_count, creator, typename lru_cache_internal::default_deletor<V>::type());
+    }
+
+    ~tiered_lru_cache()
+    {
+        delete _impl;
+        delete _store;
+    }
+
+    bool query(const key_view& k, V& v)
+    {
+        return _impl->query(k, v);
+    }
+
+    void clear()
+    {
+        _impl->clear();
+        _store->clear();
+    }
+
+    /// entries in l1
+    uint32_t size() const
+    {
+        return _impl->size();
+    }
+
+    S& store()
+    {
+        return *_store;
+    }
+
+    /// l2 hits, each one a creator call saved
+    uint64_t promotions() const
+    {
+        return _promotions;
+    }
+
+    uint64_t demotions() const
+    {
+        return _demotions;
+    }
+private:
+    template<class C, class D>
+    void init(uint32_t max_cache_count, C creator, D deletor)
+    {
+        auto user_deletor = [deletor](const K& k, V& v, lru_cache_removal reason) mutable {
+            lru_cache_internal::invoke_deletor(deletor, k, v, reason);
+        };
+        _impl = new lru_cache_internal::lru_cache_impl<K, V, tier_creator, tier_deletor>(
+            max_cache_count, tier_creator{ this, creator }, tier_deletor{ this, user_deletor });
+    }
+
+    bool promote(const K& k, V& v)
+    {
+        if (!_store->take(k, _buffer)) return false;
+
+        const char* pos = _buffer.data();
+        if (!VS::read(pos, pos + _buffer.size(), v))
+            throw std::runtime_error("tiered_lru_cache, corrupt entry");
+
+        _promotions++;
+        return true;
+    }
+
+    void demote(const K& k, const V& v)
+    {
+        _buffer.clear();
+        VS::write(_buffer, v);
+        _store->put(k, _buffer);
+        _demotions++;
+    }
+
+    S* _store;
+
+    lru_cache_internal::lru_cache_interface<K, V>* _impl = nullptr;
+
+    std::string _buffer;
+
+    uint64_t _promotions = 0;
+
+    uint64_t _demotions = 0;
+private:
+    tiered_lru_cache(const tiered_lru_cache&);
+
+    tiered_lru_cache& operator=(const tiered_lru_cache&);
+};